@@ -0,0 +1,374 @@
+#include "bvh.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+
+// Leaves or nodes per parallel task
+constexpr size_t bvhChunkSize = 16384;
+
+// The radix sort orders the 30 Morton bits of each key in three passes of this many bits
+constexpr int radixBits = 10;
+constexpr size_t radixBuckets = size_t(1) << radixBits;
+
+// A binary radix tree over distinct 64-bit keys is at most 64 levels deep
+constexpr int maxBvhDepth = 64;
+
+static double millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Spreads the low 10 bits of v so two zero bits follow each
+static uint32_t expandBits(uint32_t v) {
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+// 30-bit Morton code of a point in the unit cube
+static uint32_t morton3D(const glm::vec3& p) {
+    glm::uvec3 cell = glm::uvec3(glm::clamp(p * 1024.0f, glm::vec3(0.0f), glm::vec3(1023.0f)));
+    return (expandBits(cell.x) << 2) | (expandBits(cell.y) << 1) | expandBits(cell.z);
+}
+
+static void computeMortonKeys(Bvh& bvh, const InstanceBounds& bounds, ThreadPool& pool) {
+    size_t count = bounds.size();
+    size_t rangeCount = std::max<size_t>(1, std::min<size_t>(pool.size() * 4, count / bvhChunkSize));
+    size_t rangeSize = (count + rangeCount - 1) / rangeCount;
+
+    // Bounds of the centers, reduced per range
+    std::vector<glm::vec3> rangeMin(rangeCount, glm::vec3(FLT_MAX)), rangeMax(rangeCount, glm::vec3(-FLT_MAX));
+    pool.parallelFor(rangeCount, [&](size_t range) {
+        size_t end = std::min(count, (range + 1) * rangeSize);
+        for (size_t i = range * rangeSize; i < end; ++i) {
+            glm::vec3 center(bounds.x[i], bounds.y[i], bounds.z[i]);
+            rangeMin[range] = glm::min(rangeMin[range], center);
+            rangeMax[range] = glm::max(rangeMax[range], center);
+        }
+    });
+    glm::vec3 sceneMin(FLT_MAX), sceneMax(-FLT_MAX);
+    for (size_t range = 0; range < rangeCount; ++range) {
+        sceneMin = glm::min(sceneMin, rangeMin[range]);
+        sceneMax = glm::max(sceneMax, rangeMax[range]);
+    }
+    glm::vec3 scale = 1.0f / glm::max(sceneMax - sceneMin, glm::vec3(FLT_MIN));
+
+    // The instance index in the low half makes every key distinct, which the hierarchy relies on
+    bvh.keys.resize(count);
+    pool.parallelForRange(count, bvhChunkSize, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            glm::vec3 center(bounds.x[i], bounds.y[i], bounds.z[i]);
+            bvh.keys[i] = (uint64_t)morton3D((center - sceneMin) * scale) << 32 | i;
+        }
+    });
+}
+
+// Stable LSD radix sort of the keys by their Morton half. Each pass histograms fixed ranges in
+// parallel, prefix-sums them bucket-major and scatters every range to its own offsets.
+static void sortMortonKeys(Bvh& bvh, ThreadPool& pool) {
+    size_t count = bvh.keys.size();
+    size_t rangeCount = std::max<size_t>(1, std::min<size_t>(pool.size() * 4, count / bvhChunkSize));
+    size_t rangeSize = (count + rangeCount - 1) / rangeCount;
+    std::vector<std::array<uint32_t, radixBuckets>> rangeOffsets(rangeCount);
+    bvh.sortScratch.resize(count);
+
+    for (int shift = 32; shift < 62; shift += radixBits) {
+        const std::vector<uint64_t>& source = bvh.keys;
+        std::vector<uint64_t>& destination = bvh.sortScratch;
+
+        pool.parallelFor(rangeCount, [&](size_t range) {
+            std::array<uint32_t, radixBuckets>& histogram = rangeOffsets[range];
+            histogram.fill(0);
+            size_t end = std::min(count, (range + 1) * rangeSize);
+            for (size_t i = range * rangeSize; i < end; ++i) ++histogram[(source[i] >> shift) & (radixBuckets - 1)];
+        });
+
+        uint32_t base = 0;
+        for (size_t bucket = 0; bucket < radixBuckets; ++bucket) {
+            for (auto& offsets : rangeOffsets) {
+                uint32_t rangeBucketCount = offsets[bucket];
+                offsets[bucket] = base;
+                base += rangeBucketCount;
+            }
+        }
+
+        pool.parallelFor(rangeCount, [&](size_t range) {
+            std::array<uint32_t, radixBuckets>& offsets = rangeOffsets[range];
+            size_t end = std::min(count, (range + 1) * rangeSize);
+            for (size_t i = range * rangeSize; i < end; ++i) destination[offsets[(source[i] >> shift) & (radixBuckets - 1)]++] = source[i];
+        });
+        bvh.keys.swap(bvh.sortScratch);
+    }
+}
+
+// Length of the common prefix of keys i and j, or -1 when j is out of range
+static int commonPrefix(const std::vector<uint64_t>& keys, int64_t i, int64_t j) {
+    if (j < 0 || j >= (int64_t)keys.size()) return -1;
+    return std::countl_zero(keys[i] ^ keys[j]);
+}
+
+// Karras' construction: the direction the node's range extends in is towards the neighbor
+// sharing the longer prefix, its far end is found by exponential then binary search, and the
+// split is where the prefix shared by the whole range ends.
+static void emitNode(Bvh& bvh, int64_t i) {
+    const std::vector<uint64_t>& keys = bvh.keys;
+    int64_t direction = commonPrefix(keys, i, i + 1) - commonPrefix(keys, i, i - 1) >= 0 ? 1 : -1;
+
+    int minPrefix = commonPrefix(keys, i, i - direction);
+    int64_t lengthBound = 2;
+    while (commonPrefix(keys, i, i + lengthBound * direction) > minPrefix) lengthBound *= 2;
+    int64_t length = 0;
+    for (int64_t step = lengthBound / 2; step >= 1; step /= 2) {
+        if (commonPrefix(keys, i, i + (length + step) * direction) > minPrefix) length += step;
+    }
+    int64_t j = i + length * direction;
+
+    int nodePrefix = commonPrefix(keys, i, j);
+    int64_t split = 0;
+    for (int64_t divisor = 2;; divisor *= 2) {
+        int64_t step = (length + divisor - 1) / divisor;
+        if (commonPrefix(keys, i, i + (split + step) * direction) > nodePrefix) split += step;
+        if (step == 1) break;
+    }
+    int64_t gamma = i + split * direction + std::min<int64_t>(direction, 0);
+
+    int64_t first = std::min(i, j), last = std::max(i, j);
+    BvhNode& node = bvh.nodes[i];
+    if (first == gamma) {
+        node.left = (uint32_t)gamma | bvhLeafBit;
+        bvh.leafParent[gamma] = (uint32_t)i;
+    } else {
+        node.left = (uint32_t)gamma;
+        bvh.nodeParent[gamma] = (uint32_t)i;
+    }
+    if (last == gamma + 1) {
+        node.right = (uint32_t)(gamma + 1) | bvhLeafBit;
+        bvh.leafParent[gamma + 1] = (uint32_t)i;
+    } else {
+        node.right = (uint32_t)(gamma + 1);
+        bvh.nodeParent[gamma + 1] = (uint32_t)i;
+    }
+    bvh.nodeLeaves[i] = glm::uvec2((uint32_t)first, (uint32_t)last);
+}
+
+static void emitHierarchy(Bvh& bvh, ThreadPool& pool) {
+    size_t count = bvh.keys.size();
+    bvh.leaves.resize(count);
+    bvh.leafOfInstance.resize(count);
+    bvh.leafSpheres.resize(count);
+    bvh.leafParent.resize(count);
+    bvh.nodes.resize(count - 1);
+    bvh.nodeParent.resize(count - 1);
+    bvh.nodeLeaves.resize(count - 1);
+    bvh.refitVisits.resize(count - 1);
+    if (count > 1) {
+        bvh.nodeParent[0] = ~0u;
+    } else {
+        bvh.leafParent[0] = ~0u;
+    }
+
+    pool.parallelForRange(count, bvhChunkSize, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            uint32_t instance = (uint32_t)bvh.keys[i];
+            bvh.leaves[i] = instance;
+            bvh.leafOfInstance[instance] = (uint32_t)i;
+        }
+    });
+    pool.parallelForRange(count - 1, bvhChunkSize, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) emitNode(bvh, (int64_t)i);
+    });
+}
+
+static glm::vec4 instanceSphere(const InstanceBounds& bounds, uint32_t instance) {
+    return glm::vec4(bounds.x[instance], bounds.y[instance], bounds.z[instance], bounds.radius[instance]);
+}
+
+static void childBounds(const Bvh& bvh, uint32_t child, glm::vec3& boundsMin, glm::vec3& boundsMax) {
+    if (child & bvhLeafBit) {
+        const glm::vec4& sphere = bvh.leafSpheres[child & ~bvhLeafBit];
+        boundsMin = glm::vec3(sphere) - sphere.w;
+        boundsMax = glm::vec3(sphere) + sphere.w;
+    } else {
+        boundsMin = bvh.nodes[child].boundsMin;
+        boundsMax = bvh.nodes[child].boundsMax;
+    }
+}
+
+// Sets a node's box to the union of its children's; returns whether it changed
+static bool fitNode(Bvh& bvh, uint32_t index) {
+    BvhNode& node = bvh.nodes[index];
+    glm::vec3 leftMin, leftMax, rightMin, rightMax;
+    childBounds(bvh, node.left, leftMin, leftMax);
+    childBounds(bvh, node.right, rightMin, rightMax);
+    glm::vec3 boundsMin = glm::min(leftMin, rightMin), boundsMax = glm::max(leftMax, rightMax);
+    bool changed = boundsMin != node.boundsMin || boundsMax != node.boundsMax;
+    node.boundsMin = boundsMin;
+    node.boundsMax = boundsMax;
+    return changed;
+}
+
+BvhBuildTimes buildBvh(Bvh& bvh, const InstanceBounds& bounds, ThreadPool& pool) {
+    BvhBuildTimes times;
+    auto start = std::chrono::steady_clock::now();
+    computeMortonKeys(bvh, bounds, pool);
+    times.morton = millisecondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    sortMortonKeys(bvh, pool);
+    times.sort = millisecondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    if (bounds.size() == 0) {
+        bvh = {};
+        return times;
+    }
+    emitHierarchy(bvh, pool);
+    times.hierarchy = millisecondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    refitBvh(bvh, bounds, pool);
+    times.refit = millisecondsSince(start);
+    return times;
+}
+
+void refitBvh(Bvh& bvh, const InstanceBounds& bounds, ThreadPool& pool) {
+    // Gathering the spheres into leaf order first keeps the random reads independent of each
+    // other, rather than stalling every step of the walks below
+    pool.parallelForRange(bvh.leaves.size(), bvhChunkSize, [&](size_t begin, size_t end) {
+        for (size_t leaf = begin; leaf < end; ++leaf) bvh.leafSpheres[leaf] = instanceSphere(bounds, bvh.leaves[leaf]);
+    });
+    pool.parallelForRange(bvh.nodes.size(), bvhChunkSize, [&](size_t begin, size_t end) {
+        std::fill(bvh.refitVisits.begin() + begin, bvh.refitVisits.begin() + end, 0u);
+    });
+
+    // Every leaf walks towards the root; the first child to reach a node stops there and the
+    // second, which finds both children done, fits it and carries on
+    pool.parallelForRange(bvh.leaves.size(), bvhChunkSize, [&](size_t begin, size_t end) {
+        for (size_t leaf = begin; leaf < end; ++leaf) {
+            for (uint32_t node = bvh.leafParent[leaf]; node != ~0u; node = bvh.nodeParent[node]) {
+                if (std::atomic_ref<uint32_t>(bvh.refitVisits[node]).fetch_add(1, std::memory_order_acq_rel) == 0) break;
+                fitNode(bvh, node);
+            }
+        }
+    });
+}
+
+void refitBvhInstances(Bvh& bvh, const InstanceBounds& bounds, const std::vector<uint32_t>& moved) {
+    // A walk may fit a shared ancestor before another moved instance's side of it is up to date;
+    // that side's walk then changes the ancestor again and carries on past it
+    for (uint32_t instance : moved) {
+        uint32_t leaf = bvh.leafOfInstance[instance];
+        bvh.leafSpheres[leaf] = instanceSphere(bounds, instance);
+        for (uint32_t node = bvh.leafParent[leaf]; node != ~0u; node = bvh.nodeParent[node]) {
+            if (!fitNode(bvh, node)) break;
+        }
+    }
+}
+
+// Traverses the nodes whose box passes `visitNode`, handing leaves to `visitLeaf`. visitNode
+// returns 0 to skip a node, 1 to descend and 2 to take every leaf under it without testing them.
+template <typename VisitNode, typename VisitLeaf, typename TakeAll>
+static void traverseBvh(const Bvh& bvh, VisitNode visitNode, VisitLeaf visitLeaf, TakeAll takeAll) {
+    if (bvh.leaves.empty()) return;
+    if (bvh.nodes.empty()) {
+        visitLeaf(0u);
+        return;
+    }
+
+    uint32_t stack[maxBvhDepth + 1];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0) {
+        uint32_t index = stack[--stackSize];
+        const BvhNode& node = bvh.nodes[index];
+        int visit = visitNode(node);
+        if (visit == 0) continue;
+        if (visit == 2) {
+            takeAll(bvh.nodeLeaves[index]);
+            continue;
+        }
+        for (uint32_t child : {node.right, node.left}) {
+            if (child & bvhLeafBit) {
+                visitLeaf(child & ~bvhLeafBit);
+            } else {
+                stack[stackSize++] = child;
+            }
+        }
+    }
+}
+
+void queryBvhFrustum(const Bvh& bvh, const Frustum& frustum, std::vector<uint32_t>& out) {
+    auto visitNode = [&](const BvhNode& node) {
+        glm::vec3 center = (node.boundsMin + node.boundsMax) * 0.5f;
+        glm::vec3 extent = (node.boundsMax - node.boundsMin) * 0.5f;
+        bool inside = true;
+        for (const glm::vec4& plane : frustum.planes) {
+            float distance = glm::dot(glm::vec3(plane), center) + plane.w;
+            float reach = glm::dot(glm::abs(glm::vec3(plane)), extent);
+            if (distance < -reach) return 0;
+            if (distance < reach) inside = false;
+        }
+        return inside ? 2 : 1;
+    };
+    auto visitLeaf = [&](uint32_t leaf) {
+        const glm::vec4& sphere = bvh.leafSpheres[leaf];
+        if (sphereInFrustum(frustum, glm::vec3(sphere), sphere.w)) out.push_back(bvh.leaves[leaf]);
+    };
+    auto takeAll = [&](glm::uvec2 range) {
+        out.insert(out.end(), bvh.leaves.begin() + range.x, bvh.leaves.begin() + range.y + 1);
+    };
+    traverseBvh(bvh, visitNode, visitLeaf, takeAll);
+}
+
+bool raycastBvh(const Bvh& bvh, const glm::vec3& origin, const glm::vec3& direction,
+                float maxDistance, uint32_t& instance, float& distance) {
+    glm::vec3 inverseDirection = 1.0f / direction;
+    float nearest = maxDistance;
+    bool hit = false;
+
+    // Slab test against the nearest hit so far
+    auto visitNode = [&](const BvhNode& node) {
+        glm::vec3 t0 = (node.boundsMin - origin) * inverseDirection;
+        glm::vec3 t1 = (node.boundsMax - origin) * inverseDirection;
+        glm::vec3 tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+        float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+        float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, nearest));
+        return enter <= exit ? 1 : 0;
+    };
+    auto visitLeaf = [&](uint32_t leaf) {
+        const glm::vec4& sphere = bvh.leafSpheres[leaf];
+        glm::vec3 toCenter = glm::vec3(sphere) - origin;
+        float b = glm::dot(toCenter, direction);
+        float h = b * b - glm::dot(toCenter, toCenter) + sphere.w * sphere.w;
+        if (h < 0.0f) return;
+        float t = std::max(b - std::sqrt(h), 0.0f);
+        if (b + std::sqrt(h) >= 0.0f && t <= nearest) {
+            nearest = t;
+            instance = bvh.leaves[leaf];
+            hit = true;
+        }
+    };
+    traverseBvh(bvh, visitNode, visitLeaf, [](glm::uvec2) {});
+
+    if (hit) distance = nearest;
+    return hit;
+}
+
+void queryBvhSphere(const Bvh& bvh, const glm::vec3& center, float radius, std::vector<uint32_t>& out) {
+    auto visitNode = [&](const BvhNode& node) {
+        glm::vec3 offset = center - glm::clamp(center, node.boundsMin, node.boundsMax);
+        return glm::dot(offset, offset) <= radius * radius ? 1 : 0;
+    };
+    auto visitLeaf = [&](uint32_t leaf) {
+        const glm::vec4& sphere = bvh.leafSpheres[leaf];
+        glm::vec3 offset = glm::vec3(sphere) - center;
+        float reach = radius + sphere.w;
+        if (glm::dot(offset, offset) <= reach * reach) out.push_back(bvh.leaves[leaf]);
+    };
+    traverseBvh(bvh, visitNode, visitLeaf, [](glm::uvec2) {});
+}
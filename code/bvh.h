@@ -0,0 +1,72 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+#include "frustum.h"
+#include "instance_data.h"
+#include "thread_pool.h"
+
+// Child references of a BvhNode with this bit set are leaves (an index into Bvh::leaves)
+constexpr uint32_t bvhLeafBit = 0x80000000u;
+
+// Internal node of a Bvh. Children are internal nodes unless flagged with bvhLeafBit.
+struct BvhNode {
+    glm::vec3 boundsMin;
+    uint32_t left;
+    glm::vec3 boundsMax;
+    uint32_t right;
+};
+static_assert(sizeof(BvhNode) == 32);
+
+// Linear BVH over instance bounding spheres (Karras, "Maximizing Parallelism in the Construction
+// of BVHs, Octrees, and k-d Trees"). Leaves are the instances sorted by the Morton code of their
+// center; internal node i covers the run of leaves around leaf i that share a code prefix, so
+// every node finds its children on its own and the hierarchy is emitted in parallel.
+// n leaves make n - 1 internal nodes with the root at 0.
+struct Bvh {
+    std::vector<BvhNode> nodes;
+    std::vector<uint32_t> leaves;           // instance of each leaf, in Morton order
+    std::vector<glm::vec4> leafSpheres;     // its center and radius as of the last build or refit
+    std::vector<uint32_t> leafOfInstance;   // inverse of leaves
+    std::vector<uint32_t> nodeParent;       // the root's is ~0u
+    std::vector<uint32_t> leafParent;
+    std::vector<glm::uvec2> nodeLeaves;     // first and last leaf under each internal node
+    std::vector<uint64_t> keys;             // Morton code << 32 | instance, sorted
+    std::vector<uint64_t> sortScratch;
+    std::vector<uint32_t> refitVisits;      // children refitted so far, per internal node
+};
+
+// Milliseconds spent in each stage of buildBvh
+struct BvhBuildTimes {
+    double morton = 0.0;
+    double sort = 0.0;
+    double hierarchy = 0.0;
+    double refit = 0.0;
+
+    double total() const { return morton + sort + hierarchy + refit; }
+};
+
+// Builds the hierarchy over the spheres in `bounds` and fits its boxes.
+BvhBuildTimes buildBvh(Bvh& bvh, const InstanceBounds& bounds, ThreadPool& pool);
+
+// Refits every box bottom-up to the current bounds, keeping the topology. Far cheaper than a
+// rebuild but the boxes loosen as instances drift from where they were at build time.
+void refitBvh(Bvh& bvh, const InstanceBounds& bounds, ThreadPool& pool);
+
+// Refits only the ancestors of the given instances, stopping where a box no longer changes.
+// For when a few instances move; refitBvh is faster once a sizeable fraction has.
+void refitBvhInstances(Bvh& bvh, const InstanceBounds& bounds, const std::vector<uint32_t>& moved);
+
+// Queries see the spheres as they were at the last build or refit.
+
+// Appends the instances whose sphere intersects the frustum to `out`. Subtrees entirely inside
+// are appended without testing their spheres.
+void queryBvhFrustum(const Bvh& bvh, const Frustum& frustum, std::vector<uint32_t>& out);
+
+// Nearest sphere hit by the ray (direction normalized) at a distance in [0, maxDistance].
+// Returns false on a miss; a ray starting inside a sphere hits it at distance 0.
+bool raycastBvh(const Bvh& bvh, const glm::vec3& origin, const glm::vec3& direction,
+                float maxDistance, uint32_t& instance, float& distance);
+
+// Appends the instances whose sphere intersects the query sphere to `out`.
+void queryBvhSphere(const Bvh& bvh, const glm::vec3& center, float radius, std::vector<uint32_t>& out);
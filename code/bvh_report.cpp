@@ -0,0 +1,139 @@
+#include "bvh_report.h"
+#include "bvh.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+constexpr size_t reportSphereCount = 1000000;
+constexpr int reportBuildRuns = 5;
+constexpr int reportQueryCount = 256;
+
+static double millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static const char* matchText(bool match) {
+    return match ? "match" : "MISMATCH";
+}
+
+void reportBvh(ThreadPool& pool) {
+    // Spread like the default sphere grid: one sphere per 1.15^3 cube
+    float extent = std::cbrt((float)reportSphereCount) * 1.15f;
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> position(-extent * 0.5f, extent * 0.5f);
+    std::uniform_real_distribution<float> radius(0.2f, 0.5f);
+    InstanceBounds bounds;
+    for (size_t i = 0; i < reportSphereCount; ++i) {
+        bounds.x.push_back(position(rng));
+        bounds.y.push_back(position(rng));
+        bounds.z.push_back(position(rng));
+        bounds.radius.push_back(radius(rng));
+    }
+
+    std::printf("LBVH over %zu spheres, %u threads\n", reportSphereCount, pool.size());
+    Bvh bvh;
+    std::vector<BvhBuildTimes> builds;
+    for (int run = 0; run < reportBuildRuns; ++run) builds.push_back(buildBvh(bvh, bounds, pool));
+    std::sort(builds.begin(), builds.end(), [](const BvhBuildTimes& a, const BvhBuildTimes& b) { return a.total() < b.total(); });
+    const BvhBuildTimes& median = builds[reportBuildRuns / 2];
+    std::printf("build (median of %d): %.2f ms = morton %.2f + sort %.2f + hierarchy %.2f + refit %.2f\n", reportBuildRuns,
+                median.total(), median.morton, median.sort, median.hierarchy, median.refit);
+
+    // Nudge every sphere and refit the whole tree, then move 1% and refit just their ancestors
+    std::uniform_real_distribution<float> nudge(-0.1f, 0.1f);
+    for (size_t i = 0; i < reportSphereCount; ++i) {
+        bounds.x[i] += nudge(rng);
+        bounds.y[i] += nudge(rng);
+        bounds.z[i] += nudge(rng);
+    }
+    auto start = std::chrono::steady_clock::now();
+    refitBvh(bvh, bounds, pool);
+    std::printf("refit after moving every sphere: %.2f ms\n", millisecondsSince(start));
+
+    std::vector<uint32_t> moved;
+    std::uniform_int_distribution<uint32_t> pick(0, (uint32_t)reportSphereCount - 1);
+    for (size_t i = 0; i < reportSphereCount / 100; ++i) {
+        uint32_t instance = pick(rng);
+        bounds.x[instance] += nudge(rng);
+        bounds.y[instance] += nudge(rng);
+        bounds.z[instance] += nudge(rng);
+        moved.push_back(instance);
+    }
+    start = std::chrono::steady_clock::now();
+    refitBvhInstances(bvh, bounds, moved);
+    std::printf("refit after moving %zu spheres: %.2f ms\n", moved.size(), millisecondsSince(start));
+
+    // A camera at one face of the cube looking in
+    glm::vec3 eye(0.0f, 0.0f, extent * 0.5f + 10.0f);
+    glm::mat4 view = glm::lookAt(eye, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    Frustum frustum = extractFrustum(glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, extent) * view);
+    std::vector<uint32_t> visible, expected;
+    start = std::chrono::steady_clock::now();
+    queryBvhFrustum(bvh, frustum, visible);
+    double bvhMs = millisecondsSince(start);
+    start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < reportSphereCount; ++i) {
+        if (sphereInFrustum(frustum, glm::vec3(bounds.x[i], bounds.y[i], bounds.z[i]), bounds.radius[i])) expected.push_back(i);
+    }
+    double linearMs = millisecondsSince(start);
+    std::sort(visible.begin(), visible.end());
+    std::printf("frustum query: %zu visible in %.2f ms, linear scan %.2f ms (%s)\n", visible.size(), bvhMs, linearMs,
+                matchText(visible == expected));
+
+    // Rays from the camera through random points in the cube, and spheres around random points
+    std::vector<glm::vec3> targets(reportQueryCount);
+    for (glm::vec3& target : targets) target = glm::vec3(position(rng), position(rng), position(rng));
+
+    std::vector<uint32_t> hits(reportQueryCount, ~0u), expectedHits(reportQueryCount, ~0u);
+    start = std::chrono::steady_clock::now();
+    for (int q = 0; q < reportQueryCount; ++q) {
+        float distance;
+        raycastBvh(bvh, eye, glm::normalize(targets[q] - eye), FLT_MAX, hits[q], distance);
+    }
+    bvhMs = millisecondsSince(start);
+    start = std::chrono::steady_clock::now();
+    for (int q = 0; q < reportQueryCount; ++q) {
+        glm::vec3 direction = glm::normalize(targets[q] - eye);
+        float nearest = FLT_MAX;
+        for (uint32_t i = 0; i < reportSphereCount; ++i) {
+            glm::vec3 toCenter = glm::vec3(bounds.x[i], bounds.y[i], bounds.z[i]) - eye;
+            float b = glm::dot(toCenter, direction);
+            float h = b * b - glm::dot(toCenter, toCenter) + bounds.radius[i] * bounds.radius[i];
+            if (h >= 0.0f && b - std::sqrt(h) < nearest) {
+                nearest = b - std::sqrt(h);
+                expectedHits[q] = i;
+            }
+        }
+    }
+    linearMs = millisecondsSince(start);
+    std::printf("ray picks: %d rays in %.2f ms, linear scan %.2f ms (%s)\n", reportQueryCount, bvhMs, linearMs,
+                matchText(hits == expectedHits));
+
+    const float queryRadius = 5.0f;
+    size_t found = 0;
+    bool rangesMatch = true;
+    bvhMs = linearMs = 0.0;
+    for (const glm::vec3& target : targets) {
+        visible.clear();
+        expected.clear();
+        start = std::chrono::steady_clock::now();
+        queryBvhSphere(bvh, target, queryRadius, visible);
+        bvhMs += millisecondsSince(start);
+        start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < reportSphereCount; ++i) {
+            glm::vec3 offset = glm::vec3(bounds.x[i], bounds.y[i], bounds.z[i]) - target;
+            float reach = queryRadius + bounds.radius[i];
+            if (glm::dot(offset, offset) <= reach * reach) expected.push_back(i);
+        }
+        linearMs += millisecondsSince(start);
+        std::sort(visible.begin(), visible.end());
+        rangesMatch &= visible == expected;
+        found += visible.size();
+    }
+    std::printf("range queries: %d spheres of radius %.0f found %zu in %.2f ms, linear scan %.2f ms (%s)\n",
+                reportQueryCount, queryRadius, found, bvhMs, linearMs, matchText(rangesMatch));
+}
@@ -0,0 +1,6 @@
+#pragma once
+#include "thread_pool.h"
+
+// Builds a BVH over a million random spheres and prints the build and refit times, then the
+// frustum, ray and range query times against linear scans, checking they find the same spheres.
+void reportBvh(ThreadPool& pool);
@@ -0,0 +1,44 @@
+#include "camera.h"
+
+const char* cameraBlockSource = R"(
+layout(std140, binding = 0) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProj;
+    vec4 frustumPlanes[6];
+    vec4 cameraPosition;
+};
+)";
+
+void createCameraBuffer(CameraBuffer& camera) {
+    glGenBuffers(1, &camera.buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, camera.buffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(CameraBlock), nullptr, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, cameraBlockBinding, camera.buffer);
+    camera.dirty = true;
+}
+
+void setCamera(CameraBuffer& camera, const glm::mat4& view, const glm::mat4& projection) {
+    CameraBlock& block = camera.block;
+    if (!camera.dirty && view == block.view && projection == block.projection) return;
+
+    block.view = view;
+    block.projection = projection;
+    block.viewProj = projection * view;
+    Frustum frustum = extractFrustum(block.viewProj);
+    for (int i = 0; i < 6; ++i) block.frustumPlanes[i] = frustum.planes[i];
+    block.position = glm::inverse(view)[3];
+    camera.dirty = true;
+}
+
+void uploadCamera(CameraBuffer& camera) {
+    if (!camera.dirty) return;
+    glBindBuffer(GL_UNIFORM_BUFFER, camera.buffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(CameraBlock), &camera.block);
+    camera.dirty = false;
+}
+
+void destroyCameraBuffer(CameraBuffer& camera) {
+    glDeleteBuffers(1, &camera.buffer);
+    camera = {};
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "frustum.h"
+
+// Uniform buffer binding of the Camera block
+constexpr GLuint cameraBlockBinding = 0;
+
+// GLSL declaration of the Camera block, matching CameraBlock; insert it after a shader's #version
+// line (e.g. as a ShaderStage's defines).
+extern const char* cameraBlockSource;
+
+// std140 layout of the Camera block: only mat4 and vec4 members, so no padding rules apply
+struct CameraBlock {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 viewProj;             // projection * view
+    glm::vec4 frustumPlanes[6];     // as in Frustum
+    glm::vec4 position;             // world-space eye position, w = 1
+};
+static_assert(sizeof(CameraBlock) == 3 * 64 + 7 * 16);
+
+// Camera matrices shared by every program through one uniform buffer, bound once at creation.
+// The derived values are computed on the CPU and uploaded only when the camera changed.
+struct CameraBuffer {
+    GLuint buffer = 0;
+    CameraBlock block = {};
+    bool dirty = true;
+};
+
+void createCameraBuffer(CameraBuffer& camera);
+
+// Recomputes the derived values if view or projection differ from the current ones.
+void setCamera(CameraBuffer& camera, const glm::mat4& view, const glm::mat4& projection);
+
+// Uploads the block if it changed since the last upload.
+void uploadCamera(CameraBuffer& camera);
+
+void destroyCameraBuffer(CameraBuffer& camera);
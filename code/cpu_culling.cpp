@@ -0,0 +1,275 @@
+#include "cpu_culling.h"
+#include "mesh.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CPU_CULLING_AVX2 1
+#endif
+
+// Spheres per parallel task; a multiple of the SIMD width so only the last chunk has a tail
+constexpr size_t cullChunkSize = 16384;
+
+// Occluders rendered per frame, nearest first; the sphere grid needs several layers of them
+// before its tiles fill up
+constexpr size_t maxOccluders = 8192;
+
+void updateInstanceBounds(InstanceBounds& bounds, const std::vector<InstanceData>& instances, float meshRadius, ThreadPool& pool) {
+    size_t count = instances.size();
+    bounds.x.resize(count);
+    bounds.y.resize(count);
+    bounds.z.resize(count);
+    bounds.radius.resize(count);
+
+    pool.parallelForRange(count, cullChunkSize, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            bounds.x[i] = instances[i].position.x;
+            bounds.y[i] = instances[i].position.y;
+            bounds.z[i] = instances[i].position.z;
+            bounds.radius[i] = instances[i].scale * meshRadius;
+        }
+    });
+}
+
+static size_t cullRangeScalar(const InstanceBounds& bounds, const Frustum& frustum, size_t begin, size_t end, uint32_t* out) {
+    size_t count = 0;
+    for (size_t i = begin; i < end; ++i) {
+        glm::vec3 center(bounds.x[i], bounds.y[i], bounds.z[i]);
+        if (sphereInFrustum(frustum, center, bounds.radius[i])) out[count++] = (uint32_t)i;
+    }
+    return count;
+}
+
+#ifdef CPU_CULLING_AVX2
+__attribute__((target("avx2,fma")))
+static size_t cullRangeAvx2(const InstanceBounds& bounds, const Frustum& frustum, size_t begin, size_t end, uint32_t* out) {
+    __m256 planeX[6], planeY[6], planeZ[6], planeW[6];
+    for (int p = 0; p < 6; ++p) {
+        planeX[p] = _mm256_set1_ps(frustum.planes[p].x);
+        planeY[p] = _mm256_set1_ps(frustum.planes[p].y);
+        planeZ[p] = _mm256_set1_ps(frustum.planes[p].z);
+        planeW[p] = _mm256_set1_ps(frustum.planes[p].w);
+    }
+
+    size_t count = 0;
+    size_t i = begin;
+    for (; i + 8 <= end; i += 8) {
+        __m256 x = _mm256_loadu_ps(&bounds.x[i]);
+        __m256 y = _mm256_loadu_ps(&bounds.y[i]);
+        __m256 z = _mm256_loadu_ps(&bounds.z[i]);
+        __m256 negRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(&bounds.radius[i]));
+
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (int p = 0; p < 6; ++p) {
+            __m256 distance = _mm256_fmadd_ps(planeX[p], x, _mm256_fmadd_ps(planeY[p], y, _mm256_fmadd_ps(planeZ[p], z, planeW[p])));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negRadius, _CMP_GE_OQ));
+        }
+
+        for (unsigned mask = (unsigned)_mm256_movemask_ps(inside); mask; mask &= mask - 1) {
+            out[count++] = (uint32_t)(i + __builtin_ctz(mask));
+        }
+    }
+    return count + cullRangeScalar(bounds, frustum, i, end, out + count);
+}
+#endif
+
+// Filters [0, count) in parallel chunks, then packs the chunks' survivors together at the front
+// of visible. filter(begin, end, out) writes the survivors of a chunk to out, which is
+// visible.data() + begin, and returns how many it kept.
+template <typename ChunkFilter>
+static size_t compactChunks(std::vector<uint32_t>& visible, size_t count, ThreadPool& pool, const ChunkFilter& filter) {
+    size_t chunkCount = (count + cullChunkSize - 1) / cullChunkSize;
+    std::vector<size_t> chunkVisible(chunkCount);
+    pool.parallelFor(chunkCount, [&](size_t chunk) {
+        size_t begin = chunk * cullChunkSize;
+        size_t end = std::min(count, begin + cullChunkSize);
+        chunkVisible[chunk] = filter(begin, end, visible.data() + begin);
+    });
+
+    size_t total = 0;
+    for (size_t chunk = 0; chunk < chunkCount; ++chunk) {
+        std::memmove(visible.data() + total, visible.data() + chunk * cullChunkSize, chunkVisible[chunk] * sizeof(uint32_t));
+        total += chunkVisible[chunk];
+    }
+    visible.resize(total);
+    return total;
+}
+
+size_t cullInstanceBounds(const InstanceBounds& bounds, const Frustum& frustum, ThreadPool& pool, std::vector<uint32_t>& visible) {
+#ifdef CPU_CULLING_AVX2
+    static const bool useAvx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    auto cullRange = useAvx2 ? cullRangeAvx2 : cullRangeScalar;
+#else
+    auto cullRange = cullRangeScalar;
+#endif
+
+    visible.resize(bounds.size());
+    return compactChunks(visible, bounds.size(), pool, [&](size_t begin, size_t end, uint32_t* out) {
+        return cullRange(bounds, frustum, begin, end, out);
+    });
+}
+
+bool createCpuCuller(CpuCuller& culler, GLuint meshVBO, GLuint meshEBO, const std::vector<MeshLod>& lods,
+                     const std::vector<InstanceData>& instances, float meshRadius, ThreadPool& pool) {
+    if (lods.empty() || lods.size() > maxLods) return false;
+
+    updateInstanceBounds(culler.bounds, instances, meshRadius, pool);
+    culler.visibleIndices.reserve(instances.size());
+    culler.visibleLods.resize(instances.size());
+    if (!createInstanceStream(culler.visibleStream, instances.size())) return false;
+
+    for (const MeshLod& lod : lods) {
+        culler.commands.push_back({lod.indexCount, 0, lod.firstIndex, lod.baseVertex, 0});
+    }
+    glGenBuffers(1, &culler.commandBuffer);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, culler.commandBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, culler.commands.size() * sizeof(DrawElementsIndirectCommand), nullptr, GL_STREAM_DRAW);
+
+    glGenVertexArrays(1, &culler.vao);
+    glBindVertexArray(culler.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, meshVBO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, meshEBO);
+    setupMeshAttributes();
+    glBindBuffer(GL_ARRAY_BUFFER, culler.visibleStream.buffer);
+    setupInstanceAttributes();
+    glBindVertexArray(0);
+    return true;
+}
+
+void enableCpuOcclusion(CpuCuller& culler, int viewportWidth, int viewportHeight, const std::vector<MeshLod>& lods) {
+    resizeOcclusionBuffer(culler.occlusionBuffer, viewportWidth, viewportHeight);
+    for (size_t lod = 0; lod < lods.size() && lod < maxLods; ++lod) culler.occluderRadius[lod] = 1.0f - lods[lod].maxError;
+}
+
+// Renders the nearest visible spheres into the occlusion buffer, then drops every visible
+// instance it hides from visibleIndices, keeping their order. Returns the remaining count.
+static size_t cullOccluded(CpuCuller& culler, const glm::mat4& view, const glm::mat4& projection, const LodSelector& lodSelector,
+                           ThreadPool& pool) {
+    clearOcclusionBuffer(culler.occlusionBuffer, view, projection);
+
+    // Distance along the view direction, up to a constant
+    glm::vec3 forward = -glm::vec3(view[0][2], view[1][2], view[2][2]);
+    const InstanceBounds& bounds = culler.bounds;
+    auto nearer = [&](uint32_t a, uint32_t b) {
+        return glm::dot(forward, glm::vec3(bounds.x[a], bounds.y[a], bounds.z[a])) < glm::dot(forward, glm::vec3(bounds.x[b], bounds.y[b], bounds.z[b]));
+    };
+    std::vector<uint32_t>& visible = culler.visibleIndices;
+    std::vector<uint32_t>& nearest = culler.occluderIndices;
+    nearest.assign(visible.begin(), visible.end());
+    size_t occluderCount = std::min(maxOccluders, nearest.size());
+    std::nth_element(nearest.begin(), nearest.begin() + occluderCount, nearest.end(), nearer);
+    nearest.resize(occluderCount);
+    std::sort(nearest.begin(), nearest.end(), nearer);
+
+    culler.occluders.resize(occluderCount);
+    for (size_t i = 0; i < occluderCount; ++i) {
+        glm::vec3 center(bounds.x[nearest[i]], bounds.y[nearest[i]], bounds.z[nearest[i]]);
+        float radius = bounds.radius[nearest[i]];
+        culler.occluders[i] = glm::vec4(center, radius * culler.occluderRadius[selectLod(lodSelector, center, radius)]);
+    }
+    renderOccluderSpheres(culler.occlusionBuffer, culler.occluders, pool);
+
+    // Compacts in place: a chunk's survivors never overtake the index being read
+    return compactChunks(visible, visible.size(), pool, [&](size_t begin, size_t end, uint32_t* out) {
+        size_t kept = 0;
+        for (size_t i = begin; i < end; ++i) {
+            uint32_t index = visible[i];
+            glm::vec3 center(bounds.x[index], bounds.y[index], bounds.z[index]);
+            if (!sphereOccluded(culler.occlusionBuffer, center, bounds.radius[index])) out[kept++] = index;
+        }
+        return kept;
+    });
+}
+
+// Gathers the visible instances into out, grouped by LOD (a parallel counting sort over
+// fixed ranges), and fills in the per-LOD instance counts and base offsets.
+static void bucketVisibleByLod(CpuCuller& culler, const std::vector<InstanceData>& instances,
+                               const LodSelector& lodSelector, ThreadPool& pool, InstanceData* out) {
+    size_t count = culler.visibleIndices.size();
+    size_t lodCount = culler.commands.size();
+    size_t rangeCount = std::max<size_t>(1, std::min<size_t>(pool.size() * 4, count / cullChunkSize));
+    size_t rangeSize = (count + rangeCount - 1) / rangeCount;
+    std::vector<std::array<size_t, maxLods>> rangeOffsets(rangeCount);
+
+    pool.parallelFor(rangeCount, [&](size_t range) {
+        std::array<size_t, maxLods> histogram = {};
+        size_t end = std::min(count, (range + 1) * rangeSize);
+        for (size_t i = range * rangeSize; i < end; ++i) {
+            uint32_t index = culler.visibleIndices[i];
+            glm::vec3 center(culler.bounds.x[index], culler.bounds.y[index], culler.bounds.z[index]);
+            int lod = selectLod(lodSelector, center, culler.bounds.radius[index]);
+            culler.visibleLods[i] = (uint8_t)lod;
+            ++histogram[lod];
+        }
+        rangeOffsets[range] = histogram;
+    });
+
+    // Exclusive prefix sum, LOD-major so every LOD ends up contiguous
+    size_t base = 0;
+    for (size_t lod = 0; lod < lodCount; ++lod) {
+        culler.commands[lod].baseInstance = (GLuint)base;
+        for (auto& offsets : rangeOffsets) {
+            size_t rangeLodCount = offsets[lod];
+            offsets[lod] = base;
+            base += rangeLodCount;
+        }
+        culler.commands[lod].instanceCount = (GLuint)(base - culler.commands[lod].baseInstance);
+    }
+
+    pool.parallelFor(rangeCount, [&](size_t range) {
+        std::array<size_t, maxLods>& offsets = rangeOffsets[range];
+        size_t end = std::min(count, (range + 1) * rangeSize);
+        for (size_t i = range * rangeSize; i < end; ++i) {
+            out[offsets[culler.visibleLods[i]]++] = instances[culler.visibleIndices[i]];
+        }
+    });
+}
+
+size_t cullAndUploadCpu(CpuCuller& culler, const std::vector<InstanceData>& instances, const glm::mat4& view,
+                        const glm::mat4& projection, const LodSelector& lodSelector, ThreadPool& pool) {
+    size_t count = cullInstanceBounds(culler.bounds, extractFrustum(projection * view), pool, culler.visibleIndices);
+    culler.frustumVisibleCount = count;
+    if (!culler.occlusionBuffer.tiles.empty()) count = cullOccluded(culler, view, projection, lodSelector, pool);
+    // Bucketing by LOD is stable, so each LOD keeps this order
+    sortByDepth(culler.depthSorter, culler.visibleIndices, culler.bounds, view, culler.sortMode, pool);
+
+    // The survivors are written straight into mapped memory the GPU reads from
+    InstanceData* out = beginInstanceStreamFrame(culler.visibleStream).data();
+    if (culler.commands.size() > 1) {
+        bucketVisibleByLod(culler, instances, lodSelector, pool, out);
+    } else {
+        pool.parallelForRange(count, cullChunkSize, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                out[i] = instances[culler.visibleIndices[i]];
+            }
+        });
+        culler.commands[0].instanceCount = (GLuint)count;
+        culler.commands[0].baseInstance = 0;
+    }
+    for (DrawElementsIndirectCommand& command : culler.commands) command.baseInstance += instanceStreamBase(culler.visibleStream);
+
+    // Finer LODs are the nearer ones, so front to back also draws them first
+    std::vector<DrawElementsIndirectCommand> drawCommands = culler.commands;
+    if (culler.sortMode == SortMode::FrontToBack) std::reverse(drawCommands.begin(), drawCommands.end());
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, culler.commandBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, drawCommands.size() * sizeof(DrawElementsIndirectCommand), drawCommands.data(), GL_STREAM_DRAW);
+
+    culler.visibleCount = count;
+    return count;
+}
+
+void drawCpuCulled(CpuCuller& culler, GLenum primitive, GLenum indexType) {
+    glBindVertexArray(culler.vao);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, culler.commandBuffer);
+    glMultiDrawElementsIndirect(primitive, indexType, nullptr, (GLsizei)culler.commands.size(), 0);
+    endInstanceStreamFrame(culler.visibleStream);
+}
+
+void destroyCpuCuller(CpuCuller& culler) {
+    glDeleteVertexArrays(1, &culler.vao);
+    destroyInstanceStream(culler.visibleStream);
+    glDeleteBuffers(1, &culler.commandBuffer);
+    culler = {};
+}
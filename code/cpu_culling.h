@@ -0,0 +1,59 @@
+#pragma once
+#include <GL/glew.h>
+#include <cstdint>
+#include <vector>
+#include "depth_sort.h"
+#include "frustum.h"
+#include "gpu_culling.h"
+#include "instance_data.h"
+#include "instance_stream.h"
+#include "lod.h"
+#include "masked_occlusion.h"
+#include "thread_pool.h"
+
+// Rebuilds the bounds from the instances; meshRadius is the bounding radius of the unscaled mesh.
+void updateInstanceBounds(InstanceBounds& bounds, const std::vector<InstanceData>& instances, float meshRadius, ThreadPool& pool);
+
+// Writes the indices of the spheres that intersect the frustum to `visible` (resized to fit)
+// and returns their count. Eight spheres per iteration when the CPU supports AVX2.
+size_t cullInstanceBounds(const InstanceBounds& bounds, const Frustum& frustum, ThreadPool& pool, std::vector<uint32_t>& visible);
+
+// CPU frustum culling and LOD bucketing that writes only the visible subset, grouped by LOD,
+// straight into a persistently mapped instance stream and draws it with one indirect command per LOD.
+// Optionally also occlusion culling against the nearest spheres in a MaskedOcclusionBuffer.
+struct CpuCuller {
+    InstanceBounds bounds;
+    std::vector<uint32_t> visibleIndices;
+    std::vector<uint32_t> occluderIndices;  // nearest frustum-visible instances, front to back
+    std::vector<glm::vec4> occluders;       // their centers and inner radii
+    MaskedOcclusionBuffer occlusionBuffer;  // empty unless enableCpuOcclusion was called
+    float occluderRadius[maxLods] = {};     // per LOD: radius of a ball inside the mesh, relative to the bounding radius
+    std::vector<uint8_t> visibleLods;
+    SortMode sortMode = SortMode::None;     // order of the visible instances within each LOD
+    DepthSorter depthSorter;
+    std::vector<DrawElementsIndirectCommand> commands;  // one per LOD
+    InstanceStream visibleStream;
+    GLuint commandBuffer = 0;
+    GLuint vao = 0;             // mesh attributes + visibleStream as instance attributes
+    size_t frustumVisibleCount = 0;     // before occlusion culling
+    size_t visibleCount = 0;
+};
+
+bool createCpuCuller(CpuCuller& culler, GLuint meshVBO, GLuint meshEBO, const std::vector<MeshLod>& lods,
+                     const std::vector<InstanceData>& instances, float meshRadius, ThreadPool& pool);
+
+// Turns on occlusion culling with a buffer at the viewport resolution (one bit per pixel plus two
+// depths per 32x8 tile; at lower resolutions the spheres' inner discs cover too few whole pixels).
+// Each occluder is shrunk to a ball inside the LOD it is drawn with (from the LOD's maxError).
+void enableCpuOcclusion(CpuCuller& culler, int viewportWidth, int viewportHeight, const std::vector<MeshLod>& lods);
+
+// Culls against the frustum (and occluders, if enabled), sorts the survivors by depth if asked,
+// buckets them by LOD and writes them to the next stream segment; returns their count.
+size_t cullAndUploadCpu(CpuCuller& culler, const std::vector<InstanceData>& instances, const glm::mat4& view,
+                        const glm::mat4& projection, const LodSelector& lodSelector, ThreadPool& pool);
+
+// Draws the instances written by the last cullAndUploadCpu with the bound render program,
+// then fences their stream segment.
+void drawCpuCulled(CpuCuller& culler, GLenum primitive, GLenum indexType);
+
+void destroyCpuCuller(CpuCuller& culler);
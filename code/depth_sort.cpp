@@ -0,0 +1,86 @@
+#include "depth_sort.h"
+#include <algorithm>
+#include <array>
+#include <bit>
+
+// Indices per parallel task
+constexpr size_t sortChunkSize = 16384;
+
+constexpr int radixBits = 8;
+constexpr size_t radixBuckets = size_t(1) << radixBits;
+
+const char* sortModeName(SortMode mode) {
+    switch (mode) {
+        case SortMode::None:        return "none";
+        case SortMode::FrontToBack: return "front";
+        case SortMode::BackToFront: return "back";
+    }
+    return "?";
+}
+
+// Maps a float to an unsigned key with the same order: positives get the sign bit set,
+// negatives are flipped entirely so larger magnitudes come first
+static uint32_t floatKey(float value) {
+    uint32_t bits = std::bit_cast<uint32_t>(value);
+    return bits & 0x80000000u ? ~bits : bits | 0x80000000u;
+}
+
+void sortByDepth(DepthSorter& sorter, std::vector<uint32_t>& indices, const InstanceBounds& bounds,
+                 const glm::mat4& view, SortMode mode, ThreadPool& pool) {
+    if (mode == SortMode::None) return;
+    size_t count = indices.size();
+    sorter.keys.resize(count);
+    sorter.keyScratch.resize(count);
+    sorter.indexScratch.resize(count);
+
+    // View-space depth is minus the view-space z; back to front sorts the inverted keys
+    glm::vec4 depthRow = -glm::vec4(view[0][2], view[1][2], view[2][2], view[3][2]);
+    uint32_t flip = mode == SortMode::BackToFront ? ~0u : 0u;
+    pool.parallelForRange(count, sortChunkSize, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            uint32_t index = indices[i];
+            float depth = depthRow.x * bounds.x[index] + depthRow.y * bounds.y[index] + depthRow.z * bounds.z[index] + depthRow.w;
+            sorter.keys[i] = floatKey(depth) ^ flip;
+        }
+    });
+
+    size_t rangeCount = std::max<size_t>(1, std::min<size_t>(pool.size() * 4, count / sortChunkSize));
+    size_t rangeSize = (count + rangeCount - 1) / rangeCount;
+    std::vector<std::array<uint32_t, radixBuckets>> rangeOffsets(rangeCount);
+
+    for (int shift = 0; shift < 32; shift += radixBits) {
+        pool.parallelFor(rangeCount, [&](size_t range) {
+            std::array<uint32_t, radixBuckets>& histogram = rangeOffsets[range];
+            histogram.fill(0);
+            size_t end = std::min(count, (range + 1) * rangeSize);
+            for (size_t i = range * rangeSize; i < end; ++i) ++histogram[(sorter.keys[i] >> shift) & (radixBuckets - 1)];
+        });
+
+        // Exclusive prefix sum, bucket-major so every range scatters to its own slots. A pass
+        // where all keys fall into one bucket would copy them unchanged.
+        uint32_t base = 0;
+        bool singleBucket = false;
+        for (size_t bucket = 0; bucket < radixBuckets; ++bucket) {
+            uint32_t bucketBase = base;
+            for (auto& offsets : rangeOffsets) {
+                uint32_t rangeBucketCount = offsets[bucket];
+                offsets[bucket] = base;
+                base += rangeBucketCount;
+            }
+            singleBucket |= base - bucketBase == count;
+        }
+        if (singleBucket) continue;
+
+        pool.parallelFor(rangeCount, [&](size_t range) {
+            std::array<uint32_t, radixBuckets>& offsets = rangeOffsets[range];
+            size_t end = std::min(count, (range + 1) * rangeSize);
+            for (size_t i = range * rangeSize; i < end; ++i) {
+                uint32_t slot = offsets[(sorter.keys[i] >> shift) & (radixBuckets - 1)]++;
+                sorter.keyScratch[slot] = sorter.keys[i];
+                sorter.indexScratch[slot] = indices[i];
+            }
+        });
+        sorter.keys.swap(sorter.keyScratch);
+        indices.swap(sorter.indexScratch);
+    }
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+#include "instance_data.h"
+#include "thread_pool.h"
+
+// Order instances are drawn in
+enum class SortMode {
+    None,           // as stored
+    FrontToBack,    // nearest first, so the depth test rejects what is hidden before shading it
+    BackToFront,    // farthest first, for blending
+};
+
+const char* sortModeName(SortMode mode);
+
+// Scratch space reused across frames
+struct DepthSorter {
+    std::vector<uint32_t> keys;
+    std::vector<uint32_t> keyScratch;
+    std::vector<uint32_t> indexScratch;
+};
+
+// Reorders indices by the view-space depth of the centers in `bounds` they refer to. A stable
+// parallel LSD radix sort over 32-bit keys made from the depths' float bits, skipping the byte
+// passes in which every key agrees.
+void sortByDepth(DepthSorter& sorter, std::vector<uint32_t>& indices, const InstanceBounds& bounds,
+                 const glm::mat4& view, SortMode mode, ThreadPool& pool);
@@ -0,0 +1,53 @@
+#include "frame_stats.h"
+#include <algorithm>
+#include <cstdio>
+#include <numeric>
+
+double percentile(const std::vector<double>& sorted, double p) {
+    size_t index = (size_t)(p * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+void reportFrameStats(const FrameStats& stats, size_t instancesPerFrame, bool perFrame) {
+    if (stats.frameMs.empty()) return;
+
+    if (perFrame) {
+        std::printf("frame      ms    visible     culled  triangles\n");
+        for (size_t i = 0; i < stats.frameMs.size(); ++i) {
+            size_t visible = stats.visibleInstances[i];
+            std::printf("%5zu %7.3f %10zu %10zu %10zu\n", i, stats.frameMs[i], visible, instancesPerFrame - visible, stats.visibleTriangles[i]);
+        }
+    }
+
+    std::vector<double> sorted = stats.frameMs;
+    std::sort(sorted.begin(), sorted.end());
+
+    double totalMs = std::accumulate(sorted.begin(), sorted.end(), 0.0);
+    double meanMs = totalMs / sorted.size();
+    double framesPerSec = 1000.0 / meanMs;
+    double instancesPerSec = instancesPerFrame * framesPerSec;
+
+    auto [minVisible, maxVisible] = std::minmax_element(stats.visibleInstances.begin(), stats.visibleInstances.end());
+    double meanVisible = std::accumulate(stats.visibleInstances.begin(), stats.visibleInstances.end(), 0.0) / sorted.size();
+    double meanTriangles = std::accumulate(stats.visibleTriangles.begin(), stats.visibleTriangles.end(), 0.0) / sorted.size();
+    double trianglesPerSec = meanTriangles * framesPerSec;
+
+    std::printf("frames:          %zu\n", sorted.size());
+    std::printf("frame time (ms): min %.3f  mean %.3f  p50 %.3f  p99 %.3f\n",
+                sorted.front(), meanMs, percentile(sorted, 0.50), percentile(sorted, 0.99));
+    std::printf("visible/frame:   mean %.0f  min %zu  max %zu  (culled mean %.0f)\n",
+                meanVisible, *minVisible, *maxVisible, instancesPerFrame - meanVisible);
+    for (const auto& [name, values] : stats.timings) {
+        std::vector<double> sortedValues = values;
+        std::sort(sortedValues.begin(), sortedValues.end());
+        double mean = std::accumulate(sortedValues.begin(), sortedValues.end(), 0.0) / sortedValues.size();
+        std::printf("%-16s mean %.3f  p50 %.3f  p99 %.3f\n", (name + " (ms):").c_str(),
+                    mean, percentile(sortedValues, 0.50), percentile(sortedValues, 0.99));
+    }
+    for (const auto& [name, values] : stats.counts) {
+        double mean = std::accumulate(values.begin(), values.end(), 0.0) / values.size();
+        std::printf("%-16s mean %.1f\n", (name + ":").c_str(), mean);
+    }
+    std::printf("instances/sec:   %.3e\n", instancesPerSec);
+    std::printf("triangles/sec:   %.3e\n", trianglesPerSec);
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+using NamedSamples = std::vector<std::pair<std::string, std::vector<double>>>;
+
+// Collects per-frame times and visible instance/triangle counts for the headless benchmark.
+struct FrameStats {
+    std::vector<double> frameMs;
+    std::vector<size_t> visibleInstances;
+    std::vector<size_t> visibleTriangles;
+    NamedSamples timings;   // named per-frame CPU timings in ms
+    NamedSamples counts;    // named per-frame counts, e.g. instances per LOD
+
+    void addFrame(double ms, size_t instances, size_t triangles) {
+        frameMs.push_back(ms);
+        visibleInstances.push_back(instances);
+        visibleTriangles.push_back(triangles);
+    }
+
+    void addTiming(const std::string& name, double ms) { addSample(timings, name, ms); }
+    void addCount(const std::string& name, double value) { addSample(counts, name, value); }
+
+private:
+    static void addSample(NamedSamples& samples, const std::string& name, double value) {
+        for (auto& [sampleName, values] : samples) {
+            if (sampleName == name) {
+                values.push_back(value);
+                return;
+            }
+        }
+        samples.push_back({name, {value}});
+    }
+};
+
+// Value at fraction p (0..1) of an ascending, non-empty sample list, nearest rank
+double percentile(const std::vector<double>& sorted, double p);
+
+// Prints min/mean/p50/p99 frame time, visible/culled counts, any named timings and counts,
+// and the resulting instance and triangle throughput. Triangles/sec counts only what was
+// actually drawn.
+void reportFrameStats(const FrameStats& stats, size_t instancesPerFrame, bool perFrame = false);
@@ -0,0 +1,379 @@
+#include "gpu_culling.h"
+#include "hiz.h"
+#include "instance_data.h"
+#include "shader.h"
+#include <cstddef>
+#include <iostream>
+#include <string>
+
+// With a single LOD and no occlusion culling the select pass writes survivors directly. Otherwise survivors first
+// count per LOD, then one invocation turns the counts into base offsets, then a scatter pass
+// copies each survivor into its LOD's range, so visibleBuffer never needs more than one slot
+// per instance.
+//
+// With occlusion culling every frame dispatches twice. The early pass keeps the frustum-visible
+// instances that were visible last frame and writes the first half of the commands. The late
+// pass tests every frustum-visible instance against the Hi-Z pyramid of the early pass's depth,
+// records the result for the next frame and keeps only the instances the early pass skipped,
+// placing them after the early ones in visibleBuffer.
+static const char* cullComputeShaderSource = R"(
+#version 450 core
+#define PASS_SELECT 0
+#define PASS_OFFSETS 1
+#define PASS_SCATTER 2
+#define CULL_SINGLE 0u
+#define CULL_EARLY 1u
+#define CULL_LATE 2u
+
+layout(local_size_x = 256) in;
+
+struct DrawCommand {
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+// InstanceData is not expressible as a std430 struct (vec4 alignment would pad it),
+// so instances are copied as raw words.
+layout(std430, binding = 0) readonly buffer Instances { uint instances[]; };
+layout(std430, binding = 1) writeonly buffer VisibleInstances { uint visibleInstances[]; };
+layout(std430, binding = 2) buffer DrawCommands { DrawCommand commands[]; };
+layout(std430, binding = 3) buffer LodSlots { uint lodSlots[]; };
+#if OCCLUSION
+layout(std430, binding = 4) buffer Visibility { uint visibility[]; };   // per instance, last late pass result
+layout(std430, binding = 5) buffer CullCounters { uint frustumVisibleCount; };
+
+layout(binding = 0) uniform sampler2D hizPyramid;
+uniform mat4 hizViewProj;
+uniform vec2 viewportSize;
+uniform int hizLevels;
+#endif
+
+uniform vec4 frustumPlanes[6];
+uniform uint instanceCount;
+uniform vec3 cameraPos;
+uniform float pixelsPerUnit;
+uniform float lodMaxRadiusPixels[LOD_COUNT];
+uniform uint cullPass;
+uniform uint commandOffset;     // LOD_COUNT for the late pass, so each pass has its own commands
+
+const uint slotBits = 27u;
+const uint culled = 0xFFFFFFFFu;
+
+void copyInstance(uint id, uint slot) {
+    uint src = id * INSTANCE_WORDS;
+    uint dst = slot * INSTANCE_WORDS;
+    for (uint w = 0u; w < INSTANCE_WORDS; ++w) {
+        visibleInstances[dst + w] = instances[src + w];
+    }
+}
+
+#if PASS == PASS_SELECT
+#if OCCLUSION
+// Projects the sphere's bounding box and compares its nearest depth with the farthest depth in
+// the pyramid texels under its screen rectangle, at the level where the rectangle spans at most
+// 2x2 texels.
+bool occluded(vec3 center, float radius) {
+    vec3 ndcMin = vec3(1.0), ndcMax = vec3(-1.0);
+    for (int i = 0; i < 8; ++i) {
+        vec3 corner = center + radius * vec3((i & 1) != 0 ? 1.0 : -1.0, (i & 2) != 0 ? 1.0 : -1.0, (i & 4) != 0 ? 1.0 : -1.0);
+        vec4 clip = hizViewProj * vec4(corner, 1.0);
+        if (clip.w <= 0.0) return false;    // reaches behind the camera
+        vec3 ndc = clip.xyz / clip.w;
+        ndcMin = min(ndcMin, ndc);
+        ndcMax = max(ndcMax, ndc);
+    }
+    if (ndcMin.z < -1.0) return false;      // crosses the near plane
+
+    vec2 pixelMin = clamp((ndcMin.xy * 0.5 + 0.5) * viewportSize, vec2(0.0), viewportSize - 1.0);
+    vec2 pixelMax = clamp((ndcMax.xy * 0.5 + 0.5) * viewportSize, vec2(0.0), viewportSize - 1.0);
+    vec2 size = pixelMax - pixelMin;
+
+    // A level-n texel covers 2^(n+1) pixels
+    int level = clamp(int(ceil(log2(max(max(size.x, size.y), 1.0)))) - 1, 0, hizLevels - 1);
+    ivec2 levelSize = textureSize(hizPyramid, level);
+    ivec2 t0 = min(ivec2(pixelMin) >> (level + 1), levelSize - 1);
+    ivec2 t1 = min(ivec2(pixelMax) >> (level + 1), levelSize - 1);
+
+    // Nearest-texel textureLod rather than texelFetch: Mesa's llvmpipe ignores a texelFetch
+    // level that varies across the invocations of a dispatch.
+    vec2 texelSize = 1.0 / vec2(levelSize);
+    float lod = float(level);
+    float farthest = max(max(textureLod(hizPyramid, (vec2(t0) + 0.5) * texelSize, lod).r,
+                             textureLod(hizPyramid, (vec2(t1.x, t0.y) + 0.5) * texelSize, lod).r),
+                         max(textureLod(hizPyramid, (vec2(t0.x, t1.y) + 0.5) * texelSize, lod).r,
+                             textureLod(hizPyramid, (vec2(t1) + 0.5) * texelSize, lod).r));
+    return ndcMin.z * 0.5 + 0.5 > farthest;
+}
+#endif
+
+void main() {
+    uint id = gl_GlobalInvocationID.x;
+    if (id >= instanceCount) return;
+
+    uint src = id * INSTANCE_WORDS;
+    vec3 center = uintBitsToFloat(uvec3(instances[src], instances[src + 1u], instances[src + 2u]));
+    float radius = uintBitsToFloat(instances[src + 3u]) * MESH_RADIUS;
+
+    for (int i = 0; i < 6; ++i) {
+        if (dot(frustumPlanes[i].xyz, center) + frustumPlanes[i].w < -radius) {
+#if SCATTER
+            lodSlots[id] = culled;
+#endif
+#if OCCLUSION
+            if (cullPass == CULL_LATE) visibility[id] = 0u;
+#endif
+            return;
+        }
+    }
+
+#if OCCLUSION
+    bool drawn;
+    if (cullPass == CULL_EARLY) {
+        drawn = visibility[id] != 0u;
+    } else {
+        atomicAdd(frustumVisibleCount, 1u);
+        bool visible = !occluded(center, radius);
+        drawn = visible && visibility[id] == 0u;
+        visibility[id] = visible ? 1u : 0u;
+    }
+    if (!drawn) {
+        lodSlots[id] = culled;
+        return;
+    }
+#endif
+
+    uint lod = 0u;
+#if LOD_COUNT > 1
+    float radiusPixels = radius * pixelsPerUnit / max(distance(center, cameraPos), 1e-4);
+    while (lod < LOD_COUNT - 1u && radiusPixels > lodMaxRadiusPixels[lod]) ++lod;
+#endif
+
+    uint slot = atomicAdd(commands[commandOffset + lod].instanceCount, 1u);
+#if SCATTER
+    lodSlots[id] = (lod << slotBits) | slot;
+#else
+    copyInstance(id, slot);
+#endif
+}
+#elif PASS == PASS_OFFSETS
+void main() {
+    if (gl_GlobalInvocationID.x != 0u) return;
+    // The late pass goes after everything the early pass kept
+    uint base = 0u;
+    for (uint lod = 0u; lod < commandOffset; ++lod) base += commands[lod].instanceCount;
+    for (uint lod = commandOffset; lod < commandOffset + LOD_COUNT; ++lod) {
+        commands[lod].baseInstance = base;
+        base += commands[lod].instanceCount;
+    }
+}
+#else
+void main() {
+    uint id = gl_GlobalInvocationID.x;
+    if (id >= instanceCount) return;
+
+    uint lodSlot = lodSlots[id];
+    if (lodSlot == culled) return;
+    uint lod = commandOffset + (lodSlot >> slotBits);
+    copyInstance(id, commands[lod].baseInstance + (lodSlot & ((1u << slotBits) - 1u)));
+}
+#endif
+)";
+
+static GLuint buildCullProgram(ProgramCache& programs, const std::string& defines, const char* pass) {
+    return submitProgram(programs, {{GL_COMPUTE_SHADER, cullComputeShaderSource, defines + "#define PASS " + pass + "\n"}});
+}
+
+bool createGpuCuller(GpuCuller& culler, ProgramCache& programs, GLuint meshVBO, GLuint meshEBO, const std::vector<MeshLod>& lods,
+                     GLuint instanceBuffer, GLuint instanceCount, float meshRadius, bool occlusion) {
+    static_assert(sizeof(InstanceData) % 4 == 0);
+    static_assert(maxLods <= 32);   // LOD index is stored in the top 5 bits of a slot
+    if (lods.empty() || lods.size() > maxLods) {
+        std::cerr << "GPU culling needs 1 to " << maxLods << " LODs, got " << lods.size() << std::endl;
+        return false;
+    }
+    // The slot within a LOD takes the low 27 bits
+    if (instanceCount >= (1u << 27)) {
+        std::cerr << "GPU culling supports fewer than " << (1u << 27) << " instances, got " << instanceCount << std::endl;
+        return false;
+    }
+
+    // Occlusion culling needs the scatter passes to place late survivors after the early ones
+    bool scatter = lods.size() > 1 || occlusion;
+    std::string defines = "#define INSTANCE_WORDS " + std::to_string(sizeof(InstanceData) / 4) + "u\n"
+                          "#define MESH_RADIUS " + std::to_string(meshRadius) + "\n"
+                          "#define LOD_COUNT " + std::to_string(lods.size()) + "u\n"
+                          "#define SCATTER " + (scatter ? "1" : "0") + "\n"
+                          "#define OCCLUSION " + (occlusion ? "1" : "0") + "\n";
+    culler.selectProgram = buildCullProgram(programs, defines, "PASS_SELECT");
+    if (scatter) {
+        culler.offsetsProgram = buildCullProgram(programs, defines, "PASS_OFFSETS");
+        culler.scatterProgram = buildCullProgram(programs, defines, "PASS_SCATTER");
+    }
+
+    culler.instanceBuffer = instanceBuffer;
+    culler.instanceCount = instanceCount;
+    culler.lodCount = (GLuint)lods.size();
+
+    glGenBuffers(1, &culler.visibleBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, culler.visibleBuffer);
+    glBufferData(GL_ARRAY_BUFFER, instanceCount * sizeof(InstanceData), nullptr, GL_DYNAMIC_COPY);
+
+    if (scatter) {
+        glGenBuffers(1, &culler.lodSlotBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, culler.lodSlotBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, instanceCount * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+    }
+
+    if (occlusion) {
+        // Nothing counts as visible in the first frame, so its late pass tests everything
+        std::vector<GLuint> visibility(instanceCount, 0);
+        glGenBuffers(1, &culler.visibilityBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, culler.visibilityBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, visibility.size() * sizeof(GLuint), visibility.data(), GL_DYNAMIC_COPY);
+
+        glGenBuffers(1, &culler.counterBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, culler.counterBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+    }
+
+    // Early and late pass commands when occlusion culling
+    for (int pass = 0; pass < (occlusion ? 2 : 1); ++pass) {
+        for (const MeshLod& lod : lods) {
+            culler.commands.push_back({lod.indexCount, 0, lod.firstIndex, lod.baseVertex, 0});
+        }
+    }
+    glGenBuffers(1, &culler.commandBuffer);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, culler.commandBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, culler.commands.size() * sizeof(DrawElementsIndirectCommand), culler.commands.data(), GL_DYNAMIC_DRAW);
+
+    glGenVertexArrays(1, &culler.vao);
+    glBindVertexArray(culler.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, meshVBO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, meshEBO);
+    setupMeshAttributes();
+    glBindBuffer(GL_ARRAY_BUFFER, culler.visibleBuffer);
+    setupInstanceAttributes();
+    glBindVertexArray(0);
+
+    GpuCullUniforms& uniforms = culler.uniforms;
+    uniforms.frustumPlanes = glGetUniformLocation(culler.selectProgram, "frustumPlanes");
+    uniforms.instanceCount = glGetUniformLocation(culler.selectProgram, "instanceCount");
+    uniforms.cameraPos = glGetUniformLocation(culler.selectProgram, "cameraPos");
+    uniforms.pixelsPerUnit = glGetUniformLocation(culler.selectProgram, "pixelsPerUnit");
+    uniforms.lodMaxRadiusPixels = glGetUniformLocation(culler.selectProgram, "lodMaxRadiusPixels");
+    uniforms.cullPass = glGetUniformLocation(culler.selectProgram, "cullPass");
+    uniforms.commandOffset = glGetUniformLocation(culler.selectProgram, "commandOffset");
+    if (occlusion) {
+        uniforms.hizViewProj = glGetUniformLocation(culler.selectProgram, "hizViewProj");
+        uniforms.viewportSize = glGetUniformLocation(culler.selectProgram, "viewportSize");
+        uniforms.hizLevels = glGetUniformLocation(culler.selectProgram, "hizLevels");
+    }
+    if (scatter) {
+        uniforms.offsetsCommandOffset = glGetUniformLocation(culler.offsetsProgram, "commandOffset");
+        uniforms.scatterInstanceCount = glGetUniformLocation(culler.scatterProgram, "instanceCount");
+        uniforms.scatterCommandOffset = glGetUniformLocation(culler.scatterProgram, "commandOffset");
+    }
+    return true;
+}
+
+void dispatchGpuCulling(const GpuCuller& culler, const Frustum& frustum, const LodSelector& lodSelector,
+                        CullPass pass, const HiZBuffer* hiz) {
+    // Reset the instance counts; the rest of each command never changes. The late pass keeps
+    // the early pass's counts.
+    if (pass != CullPass::Late) {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, culler.commandBuffer);
+        glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, culler.commands.size() * sizeof(DrawElementsIndirectCommand), culler.commands.data());
+    }
+    if (pass == CullPass::Early) {
+        GLuint zero = 0;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, culler.counterBuffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &zero);
+    }
+
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, culler.instanceBuffer, culler.instanceOffset, culler.instanceCount * sizeof(InstanceData));
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, culler.visibleBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, culler.commandBuffer);
+    if (culler.lodSlotBuffer) glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, culler.lodSlotBuffer);
+    if (culler.visibilityBuffer) {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, culler.visibilityBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, culler.counterBuffer);
+    }
+
+    GLuint commandOffset = pass == CullPass::Late ? culler.lodCount : 0;
+    GLuint groups = (culler.instanceCount + 255) / 256;
+    const GpuCullUniforms& uniforms = culler.uniforms;
+    glUseProgram(culler.selectProgram);
+    glUniform4fv(uniforms.frustumPlanes, 6, &frustum.planes[0][0]);
+    glUniform1ui(uniforms.instanceCount, culler.instanceCount);
+    glUniform3fv(uniforms.cameraPos, 1, &lodSelector.cameraPos[0]);
+    glUniform1f(uniforms.pixelsPerUnit, lodSelector.pixelsPerUnit);
+    glUniform1fv(uniforms.lodMaxRadiusPixels, (GLsizei)culler.lodCount, lodSelector.maxRadiusPixels);
+    glUniform1ui(uniforms.cullPass, (GLuint)pass);
+    glUniform1ui(uniforms.commandOffset, commandOffset);
+    if (pass == CullPass::Late) {
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, hiz->pyramid);
+        glUniformMatrix4fv(uniforms.hizViewProj, 1, GL_FALSE, &hiz->viewProj[0][0]);
+        glUniform2f(uniforms.viewportSize, (float)hiz->width, (float)hiz->height);
+        glUniform1i(uniforms.hizLevels, hiz->levels);
+    }
+    glDispatchCompute(groups, 1, 1);
+
+    if (culler.scatterProgram) {
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        glUseProgram(culler.offsetsProgram);
+        glUniform1ui(uniforms.offsetsCommandOffset, commandOffset);
+        glDispatchCompute(1, 1, 1);
+
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        glUseProgram(culler.scatterProgram);
+        glUniform1ui(uniforms.scatterInstanceCount, culler.instanceCount);
+        glUniform1ui(uniforms.scatterCommandOffset, commandOffset);
+        glDispatchCompute(groups, 1, 1);
+    }
+
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+}
+
+void drawGpuCulled(const GpuCuller& culler, GLenum primitive, GLenum indexType, CullPass pass) {
+    size_t first = pass == CullPass::Late ? culler.lodCount : 0;
+    glBindVertexArray(culler.vao);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, culler.commandBuffer);
+    glMultiDrawElementsIndirect(primitive, indexType, (const void*)(first * sizeof(DrawElementsIndirectCommand)), (GLsizei)culler.lodCount, 0);
+}
+
+std::vector<GLuint> readGpuLodCounts(const GpuCuller& culler) {
+    std::vector<DrawElementsIndirectCommand> commands(culler.commands.size());
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, culler.commandBuffer);
+    glGetBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data());
+
+    // Early and late pass counts of a LOD add up
+    std::vector<GLuint> counts(culler.lodCount, 0);
+    for (size_t i = 0; i < commands.size(); ++i) counts[i % culler.lodCount] += commands[i].instanceCount;
+    return counts;
+}
+
+GLuint readGpuFrustumVisibleCount(const GpuCuller& culler) {
+    GLuint count = 0;
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, culler.counterBuffer);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &count);
+    return count;
+}
+
+void destroyGpuCuller(GpuCuller& culler) {
+    glDeleteVertexArrays(1, &culler.vao);
+    glDeleteBuffers(1, &culler.visibleBuffer);
+    glDeleteBuffers(1, &culler.commandBuffer);
+    if (culler.lodSlotBuffer) glDeleteBuffers(1, &culler.lodSlotBuffer);
+    if (culler.visibilityBuffer) glDeleteBuffers(1, &culler.visibilityBuffer);
+    if (culler.counterBuffer) glDeleteBuffers(1, &culler.counterBuffer);
+    glDeleteProgram(culler.selectProgram);
+    if (culler.offsetsProgram) glDeleteProgram(culler.offsetsProgram);
+    if (culler.scatterProgram) glDeleteProgram(culler.scatterProgram);
+    culler = {};
+}
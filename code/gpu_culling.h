@@ -0,0 +1,88 @@
+#pragma once
+#include <GL/glew.h>
+#include <vector>
+#include "frustum.h"
+#include "lod.h"
+#include "mesh.h"
+#include "shader.h"
+
+struct HiZBuffer;
+
+// Layout of the glDrawElementsIndirect argument buffer
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// Uniform locations of the culling programs, looked up once by createGpuCuller
+struct GpuCullUniforms {
+    GLint frustumPlanes = -1;
+    GLint instanceCount = -1;
+    GLint cameraPos = -1;
+    GLint pixelsPerUnit = -1;
+    GLint lodMaxRadiusPixels = -1;
+    GLint cullPass = -1;
+    GLint commandOffset = -1;
+    GLint hizViewProj = -1;     // this and the next two only with occlusion culling
+    GLint viewportSize = -1;
+    GLint hizLevels = -1;
+    GLint offsetsCommandOffset = -1;
+    GLint scatterInstanceCount = -1;
+    GLint scatterCommandOffset = -1;
+};
+
+// Compute-shader frustum culling and LOD selection. Instances whose bounding sphere passes are
+// compacted into visibleBuffer, grouped by LOD, and counted straight into one indirect draw
+// command per LOD, so the CPU never waits on the result.
+//
+// Optionally also two-phase occlusion culling against a Hi-Z pyramid (see CullPass).
+struct GpuCuller {
+    GLuint selectProgram = 0;   // frustum test + LOD choice
+    GLuint offsetsProgram = 0;  // per-LOD base offsets (only with several LODs)
+    GLuint scatterProgram = 0;  // copies survivors to their LOD's range (only with several LODs)
+    GpuCullUniforms uniforms;
+    GLuint visibleBuffer = 0;   // compacted InstanceData of the surviving instances
+    GLuint commandBuffer = 0;   // one DrawElementsIndirectCommand per LOD (and pass), instanceCount filled by the shader
+    GLuint lodSlotBuffer = 0;   // per instance: LOD and slot within it, or ~0 when culled
+    GLuint visibilityBuffer = 0;    // per instance: passed the last occlusion test (only with occlusion culling)
+    GLuint counterBuffer = 0;   // frustum-visible instance count of the late pass
+    GLuint vao = 0;             // mesh attributes + visibleBuffer as instance attributes
+    GLuint instanceBuffer = 0;  // source InstanceData
+    GLintptr instanceOffset = 0;    // byte offset of the source instances, e.g. the current stream segment
+    GLuint instanceCount = 0;
+    GLuint lodCount = 0;
+    std::vector<DrawElementsIndirectCommand> commands;  // reset values uploaded every frame
+};
+
+// Which half of a two-phase occlusion-culled frame a dispatch or draw belongs to
+enum class CullPass {
+    Single, // frustum culling only
+    Early,  // instances visible last frame; draw them, then build the Hi-Z pyramid from their depth
+    Late,   // instances the early pass skipped that pass the Hi-Z test; also updates last-frame visibility
+};
+
+// meshRadius is the bounding radius of the unscaled meshes; it is multiplied by each instance's scale.
+// occlusion enables the Early/Late passes. finishPrograms reports whether the programs built; this
+// only waits for them to link to look up their uniforms, after setting up the buffers.
+bool createGpuCuller(GpuCuller& culler, ProgramCache& programs, GLuint meshVBO, GLuint meshEBO, const std::vector<MeshLod>& lods,
+                     GLuint instanceBuffer, GLuint instanceCount, float meshRadius, bool occlusion = false);
+
+// Dispatches the culling passes. The late pass tests against hiz, which must hold the pyramid
+// built after drawing the early pass. Leaves a culling program bound.
+void dispatchGpuCulling(const GpuCuller& culler, const Frustum& frustum, const LodSelector& lodSelector,
+                        CullPass pass = CullPass::Single, const HiZBuffer* hiz = nullptr);
+
+// Draws the surviving instances of every LOD with the currently bound render program.
+void drawGpuCulled(const GpuCuller& culler, GLenum primitive, GLenum indexType, CullPass pass = CullPass::Single);
+
+// Reads back the visible count of each LOD from the last frame, both passes together. Stalls;
+// meant for benchmark reporting.
+std::vector<GLuint> readGpuLodCounts(const GpuCuller& culler);
+
+// Frustum-visible instances of the last late pass; those not drawn were occluded. Stalls.
+GLuint readGpuFrustumVisibleCount(const GpuCuller& culler);
+
+void destroyGpuCuller(GpuCuller& culler);
@@ -0,0 +1,96 @@
+#include "gpu_sim.h"
+#include "shader.h"
+#include <string>
+#include <vector>
+
+// Same integration and bounce rule as stepParticleSim
+static const char* simComputeShaderSource = R"(
+#version 450 core
+layout(local_size_x = 256) in;
+
+// Raw words, as InstanceData does not match any std430 struct layout
+layout(std430, binding = 0) buffer Instances { uint instances[]; };
+layout(std430, binding = 1) buffer Velocities { vec4 velocities[]; };   // xyz velocity, w radius
+
+uniform uint instanceCount;
+uniform float dt;
+uniform vec3 gravity;
+uniform vec3 boundsMin;
+uniform vec3 boundsMax;
+uniform float restitution;
+
+void main() {
+    uint id = gl_GlobalInvocationID.x;
+    if (id >= instanceCount) return;
+
+    uint src = id * INSTANCE_WORDS;
+    vec3 position = uintBitsToFloat(uvec3(instances[src], instances[src + 1u], instances[src + 2u]));
+    vec4 state = velocities[id];
+
+    vec3 v = state.xyz + gravity * dt;
+    vec3 p = position + v * dt;
+    vec3 minP = boundsMin + state.w;
+    vec3 maxP = boundsMax - state.w;
+
+    // Mirror the overshoot back inside the box and reverse the velocity
+    bvec3 below = lessThan(p, minP);
+    bvec3 above = greaterThan(p, maxP);
+    p = mix(mix(p, 2.0 * maxP - p, above), 2.0 * minP - p, below);
+    v = mix(v, -v * restitution, bvec3(uvec3(below) | uvec3(above)));
+
+    instances[src] = floatBitsToUint(p.x);
+    instances[src + 1u] = floatBitsToUint(p.y);
+    instances[src + 2u] = floatBitsToUint(p.z);
+    velocities[id] = vec4(v, state.w);
+}
+)";
+
+void createGpuParticleSim(GpuParticleSim& sim, ProgramCache& programs, const ParticleSim& initial, GLuint instanceBuffer) {
+    static_assert(sizeof(InstanceData) % 4 == 0);
+    std::string defines = "#define INSTANCE_WORDS " + std::to_string(sizeof(InstanceData) / 4) + "u\n";
+    sim.program = submitProgram(programs, {{GL_COMPUTE_SHADER, simComputeShaderSource, defines}});
+
+    sim.instanceBuffer = instanceBuffer;
+    sim.instanceCount = (GLuint)initial.size();
+    sim.boundsMin = initial.boundsMin;
+    sim.boundsMax = initial.boundsMax;
+    sim.gravity = initial.gravity;
+    sim.restitution = initial.restitution;
+
+    std::vector<glm::vec4> velocities(initial.size());
+    for (size_t i = 0; i < initial.size(); ++i) {
+        velocities[i] = glm::vec4(initial.vx[i], initial.vy[i], initial.vz[i], initial.radius[i]);
+    }
+    glGenBuffers(1, &sim.velocityBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, sim.velocityBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, velocities.size() * sizeof(glm::vec4), velocities.data(), GL_DYNAMIC_COPY);
+
+    sim.uniforms.instanceCount = glGetUniformLocation(sim.program, "instanceCount");
+    sim.uniforms.dt = glGetUniformLocation(sim.program, "dt");
+    sim.uniforms.gravity = glGetUniformLocation(sim.program, "gravity");
+    sim.uniforms.boundsMin = glGetUniformLocation(sim.program, "boundsMin");
+    sim.uniforms.boundsMax = glGetUniformLocation(sim.program, "boundsMax");
+    sim.uniforms.restitution = glGetUniformLocation(sim.program, "restitution");
+}
+
+void stepGpuParticleSim(const GpuParticleSim& sim, float dt) {
+    glUseProgram(sim.program);
+    glUniform1ui(sim.uniforms.instanceCount, sim.instanceCount);
+    glUniform1f(sim.uniforms.dt, dt);
+    glUniform3fv(sim.uniforms.gravity, 1, &sim.gravity[0]);
+    glUniform3fv(sim.uniforms.boundsMin, 1, &sim.boundsMin[0]);
+    glUniform3fv(sim.uniforms.boundsMax, 1, &sim.boundsMax[0]);
+    glUniform1f(sim.uniforms.restitution, sim.restitution);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, sim.instanceBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, sim.velocityBuffer);
+    glDispatchCompute((sim.instanceCount + 255) / 256, 1, 1);
+
+    glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void destroyGpuParticleSim(GpuParticleSim& sim) {
+    glDeleteBuffers(1, &sim.velocityBuffer);
+    glDeleteProgram(sim.program);
+    sim = {};
+}
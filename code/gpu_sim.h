@@ -0,0 +1,39 @@
+#pragma once
+#include <GL/glew.h>
+#include "particle_sim.h"
+#include "shader.h"
+
+// Uniform locations of the simulation program, looked up once by createGpuParticleSim
+struct GpuSimUniforms {
+    GLint instanceCount = -1;
+    GLint dt = -1;
+    GLint gravity = -1;
+    GLint boundsMin = -1;
+    GLint boundsMax = -1;
+    GLint restitution = -1;
+};
+
+// GPU-resident version of ParticleSim: a compute shader advances the positions in place in
+// the InstanceData buffer the draws read, so nothing crosses the bus after creation.
+struct GpuParticleSim {
+    GLuint program = 0;
+    GpuSimUniforms uniforms;
+    GLuint instanceBuffer = 0;  // InstanceData, positions rewritten every step
+    GLuint velocityBuffer = 0;  // per instance: velocity xyz + bounding radius
+    GLuint instanceCount = 0;
+    glm::vec3 boundsMin = glm::vec3(0.0f);
+    glm::vec3 boundsMax = glm::vec3(0.0f);
+    glm::vec3 gravity = glm::vec3(0.0f);
+    float restitution = 1.0f;
+};
+
+// Takes velocities, radii and the box from initial; instanceBuffer must already hold the
+// matching InstanceData. finishPrograms reports whether the program built; this only waits for
+// it to link to look up its uniforms, after uploading the velocities.
+void createGpuParticleSim(GpuParticleSim& sim, ProgramCache& programs, const ParticleSim& initial, GLuint instanceBuffer);
+
+// Dispatches one step and the barrier that makes the new positions visible to vertex
+// attribute fetches and later compute passes (e.g. GPU culling). Leaves the sim program bound.
+void stepGpuParticleSim(const GpuParticleSim& sim, float dt);
+
+void destroyGpuParticleSim(GpuParticleSim& sim);
@@ -0,0 +1,21 @@
+#pragma once
+#include <GL/glew.h>
+#include <EGL/egl.h>
+
+// Surfaceless EGL context rendering into an offscreen framebuffer.
+// Works without a display server, e.g. on Mesa llvmpipe.
+struct HeadlessContext {
+    EGLDisplay display = EGL_NO_DISPLAY;
+    EGLContext context = EGL_NO_CONTEXT;
+    GLuint fbo = 0;
+    GLuint colorBuffer = 0;
+    GLuint depthBuffer = 0;
+};
+
+// Creates an OpenGL 4.5 core context and makes it current. Call before glewInit().
+bool createHeadlessContext(HeadlessContext& ctx);
+
+// Creates the offscreen framebuffer and binds it as the draw target. Call after glewInit().
+bool createHeadlessFramebuffer(HeadlessContext& ctx, int width, int height);
+
+void destroyHeadlessContext(HeadlessContext& ctx);
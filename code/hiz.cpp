@@ -0,0 +1,105 @@
+#include "hiz.h"
+#include "shader.h"
+#include <algorithm>
+#include <iostream>
+
+// One 2x2 max reduction per destination texel. When the source has an odd width or height, the
+// last destination column or row also takes the source texel that would otherwise be dropped.
+static const char* reduceComputeShaderSource = R"(
+#version 450 core
+layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(binding = 0) uniform sampler2D source;       // depth texture or the previous pyramid level
+layout(r32f, binding = 0) writeonly uniform image2D destination;
+
+uniform int sourceLevel;
+
+void main() {
+    ivec2 dst = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 dstSize = imageSize(destination);
+    if (any(greaterThanEqual(dst, dstSize))) return;
+
+    ivec2 sourceSize = textureSize(source, sourceLevel);
+    ivec2 extent = ivec2(2) + ivec2(equal(dst, dstSize - 1)) * (sourceSize & 1);
+    float depth = 0.0;
+    for (int y = 0; y < extent.y; ++y) {
+        for (int x = 0; x < extent.x; ++x) {
+            depth = max(depth, texelFetch(source, min(dst * 2 + ivec2(x, y), sourceSize - 1), sourceLevel).r);
+        }
+    }
+    imageStore(destination, dst, vec4(depth));
+}
+)";
+
+bool createHiZBuffer(HiZBuffer& hiz, ProgramCache& programs, int width, int height) {
+    hiz.reduceProgram = submitProgram(programs, {{GL_COMPUTE_SHADER, reduceComputeShaderSource, ""}});
+
+    hiz.width = width;
+    hiz.height = height;
+    int levelWidth = std::max(1, (width + 1) / 2), levelHeight = std::max(1, (height + 1) / 2);
+    hiz.levels = 1;
+    while ((std::max(levelWidth, levelHeight) >> (hiz.levels - 1)) > 1) ++hiz.levels;
+
+    glGenRenderbuffers(1, &hiz.colorBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, hiz.colorBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+    glGenTextures(1, &hiz.depthTexture);
+    glBindTexture(GL_TEXTURE_2D, hiz.depthTexture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glGenTextures(1, &hiz.pyramid);
+    glBindTexture(GL_TEXTURE_2D, hiz.pyramid);
+    glTexStorage2D(GL_TEXTURE_2D, hiz.levels, GL_R32F, levelWidth, levelHeight);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, &hiz.framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, hiz.framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, hiz.colorBuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, hiz.depthTexture, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "Hi-Z framebuffer is incomplete" << std::endl;
+        return false;
+    }
+    hiz.sourceLevelLocation = glGetUniformLocation(hiz.reduceProgram, "sourceLevel");
+    return true;
+}
+
+void buildHiZPyramid(HiZBuffer& hiz, const glm::mat4& viewProj) {
+    hiz.viewProj = viewProj;
+    glUseProgram(hiz.reduceProgram);
+
+    glActiveTexture(GL_TEXTURE0);
+    for (int level = 0; level < hiz.levels; ++level) {
+        // Level 0 reads the depth buffer, every other level the one above it
+        glBindTexture(GL_TEXTURE_2D, level == 0 ? hiz.depthTexture : hiz.pyramid);
+        glUniform1i(hiz.sourceLevelLocation, level == 0 ? 0 : level - 1);
+        glBindImageTexture(0, hiz.pyramid, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+
+        int levelWidth = std::max(1, ((hiz.width + 1) / 2) >> level);
+        int levelHeight = std::max(1, ((hiz.height + 1) / 2) >> level);
+        glDispatchCompute((levelWidth + 7) / 8, (levelHeight + 7) / 8, 1);
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void blitHiZBuffer(const HiZBuffer& hiz, GLuint target) {
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, hiz.framebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target);
+    glBlitFramebuffer(0, 0, hiz.width, hiz.height, 0, 0, hiz.width, hiz.height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, target);
+}
+
+void destroyHiZBuffer(HiZBuffer& hiz) {
+    glDeleteFramebuffers(1, &hiz.framebuffer);
+    glDeleteRenderbuffers(1, &hiz.colorBuffer);
+    glDeleteTextures(1, &hiz.depthTexture);
+    glDeleteTextures(1, &hiz.pyramid);
+    glDeleteProgram(hiz.reduceProgram);
+    hiz = {};
+}
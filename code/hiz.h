@@ -0,0 +1,33 @@
+#pragma once
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "shader.h"
+
+// Offscreen render target whose depth can be sampled, plus a hierarchical-Z pyramid built from
+// it: level 0 is half the framebuffer resolution and every texel holds the farthest depth of
+// the pixels it covers, so a test against it can only err towards "visible".
+struct HiZBuffer {
+    GLuint framebuffer = 0;
+    GLuint colorBuffer = 0;     // RGBA8 renderbuffer, blitted to the real target at the end of a frame
+    GLuint depthTexture = 0;    // DEPTH_COMPONENT32F
+    GLuint pyramid = 0;         // R32F, full mip chain down to 1x1
+    GLuint reduceProgram = 0;
+    GLint sourceLevelLocation = -1;     // of reduceProgram's sourceLevel uniform
+    int width = 0;              // of the framebuffer
+    int height = 0;
+    int levels = 0;             // pyramid mip levels
+    glm::mat4 viewProj = glm::mat4(1.0f);   // the depth was rendered with this; set by buildHiZPyramid
+};
+
+// finishPrograms reports whether the reduce program built; this only waits for it to link to
+// look up its uniform, after creating the textures.
+bool createHiZBuffer(HiZBuffer& hiz, ProgramCache& programs, int width, int height);
+
+// Downsamples the current depth into the pyramid and records the matrix it was rendered with.
+// Ends with the barrier that makes the pyramid visible to texture fetches.
+void buildHiZPyramid(HiZBuffer& hiz, const glm::mat4& viewProj);
+
+// Copies the rendered color to `target` and binds it as the framebuffer.
+void blitHiZBuffer(const HiZBuffer& hiz, GLuint target);
+
+void destroyHiZBuffer(HiZBuffer& hiz);
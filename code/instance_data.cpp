@@ -0,0 +1,36 @@
+#include "instance_data.h"
+#include <cstddef>
+
+InstanceData makeInstance(const glm::vec3& position, float scale, const glm::quat& rotation, const glm::vec4& color) {
+    glm::quat q = glm::normalize(rotation);
+    return {position, scale, glm::packSnorm4x8(glm::vec4(q.x, q.y, q.z, q.w)), glm::packUnorm4x8(color)};
+}
+
+glm::quat instanceRotation(const InstanceData& instance) {
+    glm::vec4 q = glm::unpackSnorm4x8(instance.rotation);
+    return glm::normalize(glm::quat(q.w, q.x, q.y, q.z));
+}
+
+glm::vec4 instanceColor(const InstanceData& instance) {
+    return glm::unpackUnorm4x8(instance.color);
+}
+
+glm::mat4 instanceModelMatrix(const InstanceData& instance) {
+    glm::mat4 model = glm::mat4_cast(instanceRotation(instance)) * instance.scale;
+    model[3] = glm::vec4(instance.position, 1.0f);
+    return model;
+}
+
+void setupInstanceAttributes() {
+    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void *)offsetof(InstanceData, position));
+    glEnableVertexAttribArray(2);
+    glVertexAttribDivisor(2, 1);
+
+    glVertexAttribPointer(3, 4, GL_BYTE, GL_TRUE, sizeof(InstanceData), (void *)offsetof(InstanceData, rotation));
+    glEnableVertexAttribArray(3);
+    glVertexAttribDivisor(3, 1);
+
+    glVertexAttribPointer(4, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(InstanceData), (void *)offsetof(InstanceData, color));
+    glEnableVertexAttribArray(4);
+    glVertexAttribDivisor(4, 1);
+}
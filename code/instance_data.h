@@ -0,0 +1,35 @@
+#pragma once
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <cstdint>
+#include <vector>
+
+// Compact per-instance record, expanded to a model matrix in the vertex shader.
+// 24 bytes instead of the 76 needed for a mat4 + vec3 color. Position stays in full
+// float so multi-million instance scenes spanning hundreds of units keep their precision.
+struct InstanceData {
+    glm::vec3 position;     // translation
+    float scale;            // uniform scale
+    uint32_t rotation;      // unit quaternion (x, y, z, w) as snorm8
+    uint32_t color;         // RGBA8 unorm
+};
+static_assert(sizeof(InstanceData) == 24);
+
+// Structure-of-arrays copy of the instance bounding spheres, kept alongside the instances
+// so culling and the BVH stream through tightly packed floats.
+struct InstanceBounds {
+    std::vector<float> x, y, z, radius;
+
+    size_t size() const { return x.size(); }
+};
+
+InstanceData makeInstance(const glm::vec3& position, float scale, const glm::quat& rotation, const glm::vec4& color);
+
+glm::quat instanceRotation(const InstanceData& instance);
+glm::vec4 instanceColor(const InstanceData& instance);
+glm::mat4 instanceModelMatrix(const InstanceData& instance);
+
+// Points attribute locations 2 (position + scale), 3 (rotation) and 4 (color) at the
+// InstanceData array in the buffer currently bound to GL_ARRAY_BUFFER.
+void setupInstanceAttributes();
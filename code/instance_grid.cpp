@@ -0,0 +1,160 @@
+#include "instance_grid.h"
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define INSTANCE_GRID_AVX2 1
+#endif
+
+const char* instanceGridSource = R"(
+#define PROCEDURAL_INSTANCES 1
+uniform ivec3 gridSize;
+uniform vec3 gridOrigin;    // center of instance 0
+uniform float gridSpread;
+uniform float gridScale;
+
+vec4 instancePositionScale;
+vec4 instanceRotation;
+vec4 instanceColor;
+
+void loadGridInstance() {
+    int row = gl_InstanceID / gridSize.z;
+    ivec3 cell = ivec3(row / gridSize.y, row % gridSize.y, gl_InstanceID % gridSize.z);
+    // precise: rounded after the multiply, like gridCoordinate
+    precise vec3 position = vec3(cell) * gridSpread + gridOrigin;
+    instancePositionScale = vec4(position, gridScale);
+    instanceRotation = vec4(0.0, 0.0, 0.0, 1.0);
+    // The RGBA8 channels of a stored instance, as in gridChannel
+    ivec3 channel = (510 * (cell + 1) + gridSize) / (2 * gridSize);
+    instanceColor = vec4(vec3(channel) * (1.0 / 255.0), 1.0);
+}
+)";
+
+// Instances per parallel task, in whole rows
+constexpr size_t gridChunkSize = 16384;
+
+// Center of instance 0; rows and columns are one spread apart from there
+static glm::vec3 gridOrigin(const InstanceGrid& grid) {
+    return glm::vec3((-grid.x / 2.0f) * grid.spread, grid.spread, (-grid.z / 2.0f) * grid.spread);
+}
+
+// spread * index + origin with the product rounded on its own, as the precise GLSL in
+// instanceGridSource does. The volatile keeps the compiler from fusing it into an FMA.
+static float gridCoordinate(float spread, int index, float origin) {
+    volatile float offset = spread * index;
+    return offset + origin;
+}
+
+// (index + 1) / size in unorm8, rounded to nearest in integers so the vertex shader of
+// --procedural computes exactly the same value
+static uint32_t gridChannel(int index, int size) {
+    return (uint32_t)((510 * ((int64_t)index + 1) + size) / (2 * (int64_t)size));
+}
+
+// What varies along each axis, computed once per grid. Every color channel is packed on its
+// own, so OR-ing them gives the whole color.
+struct GridAxes {
+    std::vector<float> x, y, z;
+    std::vector<uint32_t> red, green, blue;
+    float scale;
+    uint32_t rotation;
+    uint32_t alpha;
+};
+
+static void writeRowScalar(InstanceData* row, const GridAxes& axes, float x, float y, uint32_t color, int begin, int end) {
+    for (int k = begin; k < end; ++k) {
+        row[k] = {glm::vec3(x, y, axes.z[k]), axes.scale, axes.rotation, color | axes.blue[k]};
+    }
+}
+
+#ifdef INSTANCE_GRID_AVX2
+// Eight 24-byte instances are six 32-byte stores. Within a row only z and the blue channel
+// vary; they are interleaved as (z, color) pairs, and each store blends its pairs into a
+// template holding the row's x, y, scale and rotation.
+__attribute__((target("avx2")))
+static void writeRowAvx2(InstanceData* row, const GridAxes& axes, float x, float y, uint32_t color, int count) {
+    float rotation = std::bit_cast<float>(axes.rotation);
+    const __m256 templates[3] = {
+        _mm256_setr_ps(x, y, 0.0f, axes.scale, rotation, 0.0f, x, y),
+        _mm256_setr_ps(0.0f, axes.scale, rotation, 0.0f, x, y, 0.0f, axes.scale),
+        _mm256_setr_ps(rotation, 0.0f, x, y, 0.0f, axes.scale, rotation, 0.0f),
+    };
+    // Positions of the pairs (z0 c0 z1 c1 z2 c2 z3 c3) in each of the three stores per four instances
+    const __m256i pairSlots[3] = {
+        _mm256_setr_epi32(0, 0, 0, 0, 0, 1, 0, 0),
+        _mm256_setr_epi32(2, 0, 0, 3, 0, 0, 4, 0),
+        _mm256_setr_epi32(0, 5, 0, 0, 6, 0, 0, 7),
+    };
+    __m256i rowColor = _mm256_set1_epi32((int)color);
+
+    int k = 0;
+    for (; k + 8 <= count; k += 8) {
+        __m256 z = _mm256_loadu_ps(&axes.z[k]);
+        __m256 c = _mm256_castsi256_ps(_mm256_or_si256(rowColor, _mm256_loadu_si256((const __m256i*)&axes.blue[k])));
+        __m256 low = _mm256_unpacklo_ps(z, c);     // z0 c0 z1 c1 | z4 c4 z5 c5
+        __m256 high = _mm256_unpackhi_ps(z, c);    // z2 c2 z3 c3 | z6 c6 z7 c7
+        __m256 pairs[2] = {_mm256_permute2f128_ps(low, high, 0x20), _mm256_permute2f128_ps(low, high, 0x31)};
+
+        float* out = (float*)(row + k);
+        for (int half = 0; half < 2; ++half) {
+            _mm256_storeu_ps(out + 24 * half, _mm256_blend_ps(templates[0], _mm256_permutevar8x32_ps(pairs[half], pairSlots[0]), 0x24));
+            _mm256_storeu_ps(out + 24 * half + 8, _mm256_blend_ps(templates[1], _mm256_permutevar8x32_ps(pairs[half], pairSlots[1]), 0x49));
+            _mm256_storeu_ps(out + 24 * half + 16, _mm256_blend_ps(templates[2], _mm256_permutevar8x32_ps(pairs[half], pairSlots[2]), 0x92));
+        }
+    }
+    writeRowScalar(row, axes, x, y, color, k, count);
+}
+#endif
+
+void generateInstanceGrid(std::vector<InstanceData>& instances, const InstanceGrid& grid, ThreadPool& pool) {
+    static_assert(sizeof(InstanceData) == 6 * sizeof(float));
+    GridAxes axes;
+    glm::vec3 origin = gridOrigin(grid);
+    for (int i = 0; i < grid.x; ++i) {
+        axes.x.push_back(gridCoordinate(grid.spread, i, origin.x));
+        axes.red.push_back(gridChannel(i, grid.x));
+    }
+    for (int j = 0; j < grid.y; ++j) {
+        axes.y.push_back(gridCoordinate(grid.spread, j, origin.y));
+        axes.green.push_back(gridChannel(j, grid.y) << 8);
+    }
+    for (int k = 0; k < grid.z; ++k) {
+        axes.z.push_back(gridCoordinate(grid.spread, k, origin.z));
+        axes.blue.push_back(gridChannel(k, grid.z) << 16);
+    }
+    InstanceData identity = makeInstance(glm::vec3(0.0f), grid.scale, glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+    axes.scale = identity.scale;
+    axes.rotation = identity.rotation;
+    axes.alpha = identity.color;
+
+#ifdef INSTANCE_GRID_AVX2
+    static const bool useAvx2 = __builtin_cpu_supports("avx2");
+#endif
+
+    instances.resize((size_t)grid.x * grid.y * grid.z);
+    size_t rows = (size_t)grid.x * grid.y;
+    pool.parallelForRange(rows, std::max<size_t>(1, gridChunkSize / grid.z), [&](size_t begin, size_t end) {
+        for (size_t row = begin; row < end; ++row) {
+            size_t i = row / grid.y, j = row % grid.y;
+            InstanceData* out = instances.data() + row * grid.z;
+            uint32_t color = axes.red[i] | axes.green[j] | axes.alpha;
+#ifdef INSTANCE_GRID_AVX2
+            if (useAvx2) {
+                writeRowAvx2(out, axes, axes.x[i], axes.y[j], color, grid.z);
+                continue;
+            }
+#endif
+            writeRowScalar(out, axes, axes.x[i], axes.y[j], color, 0, grid.z);
+        }
+    });
+}
+
+void setInstanceGridUniforms(GLuint program, const InstanceGrid& grid) {
+    glm::vec3 origin = gridOrigin(grid);
+    glProgramUniform3i(program, glGetUniformLocation(program, "gridSize"), grid.x, grid.y, grid.z);
+    glProgramUniform3f(program, glGetUniformLocation(program, "gridOrigin"), origin.x, origin.y, origin.z);
+    glProgramUniform1f(program, glGetUniformLocation(program, "gridSpread"), grid.spread);
+    glProgramUniform1f(program, glGetUniformLocation(program, "gridScale"), grid.scale);
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <GL/glew.h>
+#include <vector>
+#include "instance_data.h"
+#include "thread_pool.h"
+
+// The demo's box of spheres: x * y * z instances, spread apart, centered on the origin in x
+// and z and starting one spacing above the ground
+struct InstanceGrid {
+    int x = 30;
+    int y = 30;
+    int z = 30;
+    float spread = 1.15f;
+    float scale = 0.33f;
+};
+
+// Resizes instances to the grid and fills them in parallel, rows of z along the innermost
+// index (i * y * z + j * z + k). Colors run from dark to full along each axis; rotations are
+// the identity. An AVX2 kernel writes 8 instances per step where the CPU has it.
+void generateInstanceGrid(std::vector<InstanceData>& instances, const InstanceGrid& grid, ThreadPool& pool);
+
+// GLSL for vertex shaders that compute their instance from gl_InstanceID instead of reading the
+// InstanceData attributes: defines PROCEDURAL_INSTANCES, the grid uniforms, and
+// loadGridInstance(), which sets instancePositionScale, instanceRotation and instanceColor to
+// what generateInstanceGrid would store. Insert it after #version like cameraBlockSource.
+extern const char* instanceGridSource;
+
+// Sets the uniforms declared by instanceGridSource on a linked program.
+void setInstanceGridUniforms(GLuint program, const InstanceGrid& grid);
@@ -0,0 +1,51 @@
+#include "instance_stream.h"
+#include <algorithm>
+
+bool createInstanceStream(InstanceStream& stream, size_t capacity) {
+    // Segments are also bound as SSBO ranges, so their byte offsets must meet that alignment
+    GLint alignment = 1;
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    capacity = std::max<size_t>(capacity, 1);
+    while ((capacity * sizeof(InstanceData)) % alignment != 0) ++capacity;
+
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    GLsizeiptr size = (GLsizeiptr)(capacity * sizeof(InstanceData) * instanceStreamSegments);
+    glGenBuffers(1, &stream.buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, stream.buffer);
+    glBufferStorage(GL_ARRAY_BUFFER, size, nullptr, flags);
+    stream.mapped = (InstanceData*)glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags);
+    if (!stream.mapped) {
+        glDeleteBuffers(1, &stream.buffer);
+        stream = {};
+        return false;
+    }
+    stream.capacity = capacity;
+    return true;
+}
+
+std::span<InstanceData> beginInstanceStreamFrame(InstanceStream& stream) {
+    stream.segment = (stream.segment + 1) % instanceStreamSegments;
+    GLsync& fence = stream.fences[stream.segment];
+    if (fence) {
+        // Flush on the first wait so the fence is guaranteed to signal
+        GLbitfield waitFlags = GL_SYNC_FLUSH_COMMANDS_BIT;
+        while (glClientWaitSync(fence, waitFlags, 1000000) == GL_TIMEOUT_EXPIRED) waitFlags = 0;
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+    return {stream.mapped + instanceStreamBase(stream), stream.capacity};
+}
+
+void endInstanceStreamFrame(InstanceStream& stream) {
+    stream.fences[stream.segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void destroyInstanceStream(InstanceStream& stream) {
+    for (GLsync fence : stream.fences) {
+        if (fence) glDeleteSync(fence);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, stream.buffer);
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+    glDeleteBuffers(1, &stream.buffer);
+    stream = {};
+}
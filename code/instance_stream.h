@@ -0,0 +1,32 @@
+#pragma once
+#include <GL/glew.h>
+#include <span>
+#include "instance_data.h"
+
+constexpr int instanceStreamSegments = 3;
+
+// Persistently mapped ring of InstanceData segments for data rewritten every frame. The CPU
+// fills one segment while the GPU may still read the other two; a fence per segment makes
+// the CPU wait only when it laps the GPU, never on an implicit driver sync.
+struct InstanceStream {
+    GLuint buffer = 0;
+    InstanceData* mapped = nullptr;
+    size_t capacity = 0;        // instances per segment, rounded up to keep segment offsets SSBO-aligned
+    int segment = -1;           // segment handed out by the last beginInstanceStreamFrame
+    GLsync fences[instanceStreamSegments] = {};
+};
+
+bool createInstanceStream(InstanceStream& stream, size_t capacity);
+
+// Waits for the GPU to release the next segment and returns it for writing. Attribute
+// pointers set up on stream.buffer reach it with baseInstance = instanceStreamBase(stream).
+std::span<InstanceData> beginInstanceStreamFrame(InstanceStream& stream);
+
+// First instance of the current segment
+inline GLuint instanceStreamBase(const InstanceStream& stream) { return (GLuint)(stream.segment * stream.capacity); }
+inline GLintptr instanceStreamOffset(const InstanceStream& stream) { return instanceStreamBase(stream) * sizeof(InstanceData); }
+
+// Fences the current segment; call after the last command that reads it has been issued.
+void endInstanceStreamFrame(InstanceStream& stream);
+
+void destroyInstanceStream(InstanceStream& stream);
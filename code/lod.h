@@ -0,0 +1,38 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <vector>
+#include "mesh.h"
+
+constexpr int maxLods = 8;
+
+// Picks a mesh LOD from the projected radius of an instance in pixels. LOD 0 is the coarsest.
+struct LodSelector {
+    int lodCount = 1;
+    float maxRadiusPixels[maxLods] = {};    // LOD i is used up to this projected radius; the last LOD takes the rest
+    glm::vec3 cameraPos = glm::vec3(0.0f);
+    float pixelsPerUnit = 1.0f;             // projected size in pixels of one unit at distance one
+};
+
+// Sets the thresholds so that no LOD's edges span more than edgePixels on screen.
+inline LodSelector makeLodSelector(const std::vector<MeshLod>& lods, float edgePixels) {
+    LodSelector selector;
+    selector.lodCount = std::min((int)lods.size(), maxLods);
+    for (int lod = 0; lod < selector.lodCount; ++lod) {
+        float edgeAngle = lods[lod].maxEdgeAngle;
+        selector.maxRadiusPixels[lod] = edgeAngle > 0.0f ? edgePixels / edgeAngle : 0.0f;
+    }
+    return selector;
+}
+
+inline void updateLodCamera(LodSelector& selector, const glm::vec3& cameraPos, const glm::mat4& projection, int viewportHeight) {
+    selector.cameraPos = cameraPos;
+    selector.pixelsPerUnit = projection[1][1] * viewportHeight * 0.5f;
+}
+
+inline int selectLod(const LodSelector& selector, const glm::vec3& center, float radius) {
+    float radiusPixels = radius * selector.pixelsPerUnit / std::max(glm::length(center - selector.cameraPos), 1e-4f);
+    int lod = 0;
+    while (lod < selector.lodCount - 1 && radiusPixels > selector.maxRadiusPixels[lod]) ++lod;
+    return lod;
+}
@@ -4,39 +4,88 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <vector>
+#include <algorithm>
 #include <iostream>
 #include <cmath>
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include "options.h"
+#include "headless_context.h"
+#include "hiz.h"
+#include "frame_stats.h"
+#include "instance_data.h"
+#include "instance_grid.h"
+#include "mesh.h"
+#include "shader.h"
+#include "gpu_culling.h"
+#include "camera.h"
+#include "cpu_culling.h"
+#include "thread_pool.h"
+#include "lod.h"
+#include "mesh_report.h"
+#include "bvh_report.h"
+#include "instance_stream.h"
+#include "particle_sim.h"
+#include "picking.h"
+#include "profiler.h"
+#include "gpu_sim.h"
+#include "sweep.h"
 
-constexpr int screenWidth = 800;
-constexpr int screenHeight = 600;
 int oldTimeSinceStart = 0;
 
-struct InstanceData {
-    glm::mat4 model;
-    glm::vec3 color;
-};
-
-// Shader source code
+// Shader source code; every program gets the Camera uniform block (camera.h) after #version
 const char* vertexShaderSource = R"(
 #version 450 core
+#define NORMAL_INVERSE 0
+#define NORMAL_PRECOMPUTED 1
+#define NORMAL_UNIFORM_SCALE 2
+
 layout(location = 0) in vec3 aPos;
 layout(location = 1) in vec3 aNormal;
-layout(location = 2) in mat4 instanceModel;
-layout(location = 6) in vec3 instanceColor;
-
-uniform mat4 view;
-uniform mat4 projection;
+#ifndef PROCEDURAL_INSTANCES
+layout(location = 2) in vec4 instancePositionScale;    // xyz = translation, w = uniform scale
+layout(location = 3) in vec4 instanceRotation;         // quaternion
+layout(location = 4) in vec4 instanceColor;
+#endif
+#if NORMAL_MODE == NORMAL_PRECOMPUTED
+layout(location = 5) in mat3 instanceNormalMatrix;
+#endif
 
 out vec3 FragPos;
 out vec3 Normal;
 out vec3 Color;
 
+mat3 quatToMat3(vec4 q) {
+    vec3 q2 = q.xyz * 2.0;
+    vec3 qq = q.xyz * q2;
+    float xy = q.x * q2.y, xz = q.x * q2.z, yz = q.y * q2.z;
+    vec3 wq = q.w * q2;
+    return mat3(1.0 - qq.y - qq.z, xy + wq.z,         xz - wq.y,
+                xy - wq.z,         1.0 - qq.x - qq.z, yz + wq.x,
+                xz + wq.y,         yz - wq.x,         1.0 - qq.x - qq.y);
+}
+
 void main() {
-    mat4 model = instanceModel;
+#ifdef PROCEDURAL_INSTANCES
+    loadGridInstance();
+#endif
+    mat3 rotation = quatToMat3(normalize(instanceRotation));
+    mat4 model = mat4(vec4(rotation[0] * instancePositionScale.w, 0.0),
+                      vec4(rotation[1] * instancePositionScale.w, 0.0),
+                      vec4(rotation[2] * instancePositionScale.w, 0.0),
+                      vec4(instancePositionScale.xyz, 1.0));
     FragPos = vec3(model * vec4(aPos, 1.0));
+#if NORMAL_MODE == NORMAL_INVERSE
     Normal = mat3(transpose(inverse(model))) * aNormal;
-    Color = instanceColor;
-    gl_Position = projection * view * vec4(FragPos, 1.0);
+#elif NORMAL_MODE == NORMAL_PRECOMPUTED
+    Normal = instanceNormalMatrix * aNormal;
+#else
+    // Uniform scale: the normal only needs the rotation
+    Normal = rotation * aNormal;
+#endif
+    Color = instanceColor.rgb;
+    gl_Position = viewProj * vec4(FragPos, 1.0);
 }
 )";
 
@@ -49,88 +98,157 @@ in vec3 Color;
 
 out vec4 FragColor;
 
+const vec3 lightDir = normalize(vec3(0.4, 1.0, 0.3));
+
 void main() {
-    FragColor = vec4(Color, 1.0);
+    float diffuse = max(dot(normalize(Normal), lightDir), 0.0);
+    FragColor = vec4(Color * (0.3 + 0.7 * diffuse), 1.0);
 }
 )";
 
-void generateSphere(std::vector<float>& vertices, std::vector<unsigned int>& indices, unsigned int latitudeBands = 30, unsigned int longitudeBands = 30) {
-    const float radius = 1.0f;
-    vertices.clear();
-    indices.clear();
-
-    // Generate vertices and normals
-    for (unsigned int lat = 0; lat <= latitudeBands; ++lat) {
-        float theta = lat * M_PI / latitudeBands;
-        float sinTheta = std::sin(theta);
-        float cosTheta = std::cos(theta);
-
-        for (unsigned int lon = 0; lon <= longitudeBands; ++lon) {
-            float phi = lon * 2.0f * M_PI / longitudeBands;
-            float sinPhi = std::sin(phi);
-            float cosPhi = std::cos(phi);
-
-            float x = cosPhi * sinTheta;
-            float y = cosTheta;
-            float z = sinPhi * sinTheta;
-
-            vertices.push_back(radius * x);
-            vertices.push_back(radius * y);
-            vertices.push_back(radius * z);
-
-            vertices.push_back(x);
-            vertices.push_back(y);
-            vertices.push_back(z);
-        }
-    }
-
-    // Generate indices
-    for (unsigned int lat = 0; lat < latitudeBands; ++lat) {
-        for (unsigned int lon = 0; lon < longitudeBands; ++lon) {
-            unsigned int first = (lat * (longitudeBands + 1)) + lon;
-            unsigned int second = first + longitudeBands + 1;
+// Ray-cast sphere impostors: one quad per instance on the plane through the sphere's nearest
+// point, sized to the silhouette (the tangent cone's cross-section), solved per fragment.
+const char* impostorVertexShaderSource = R"(
+#version 450 core
+layout(location = 0) in vec3 aPos;                     // quad corner in [-1, 1]
+#ifndef PROCEDURAL_INSTANCES
+layout(location = 2) in vec4 instancePositionScale;
+layout(location = 4) in vec4 instanceColor;
+#endif
 
-            indices.push_back(first);
-            indices.push_back(second);
-            indices.push_back(first + 1);
+out vec3 QuadPos;
+flat out vec3 SphereCenter;
+flat out float SphereRadius;
+flat out vec3 Color;
 
-            indices.push_back(second);
-            indices.push_back(second + 1);
-            indices.push_back(first + 1);
-        }
-    }
+void main() {
+#ifdef PROCEDURAL_INSTANCES
+    loadGridInstance();
+#endif
+    vec3 center = vec3(view * vec4(instancePositionScale.xyz, 1.0));
+    float radius = instancePositionScale.w;
+    float dist = length(center);
+    vec3 axis = center / dist;
+
+    // Collapses to a point when the camera is inside the sphere
+    float frontDist = dist - radius;
+    float halfSize = frontDist > 0.0 ? radius * sqrt(frontDist / (dist + radius)) : 0.0;
+    vec3 right = normalize(cross(axis, abs(axis.y) < 0.99 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0)));
+    vec3 up = cross(right, axis);
+
+    QuadPos = axis * frontDist + (right * aPos.x + up * aPos.y) * halfSize;
+    SphereCenter = center;
+    SphereRadius = radius;
+    Color = instanceColor.rgb;
+    gl_Position = projection * vec4(QuadPos, 1.0);
 }
+)";
 
-GLuint compileShader(GLenum type, const char* source) {
-    GLuint shader = glCreateShader(type);
-    glShaderSource(shader, 1, &source, nullptr);
-    glCompileShader(shader);
-
-    int success;
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        char infoLog[512];
-        glGetShaderInfoLog(shader, 512, nullptr, infoLog);
-        std::cerr << "Error compiling shader: " << infoLog << std::endl;
-    }
-    return shader;
+const char* impostorFragmentShaderSource = R"(
+#version 450 core
+// The sphere surface is never in front of its front tangent plane, so early depth tests stay valid
+layout(depth_greater) out float gl_FragDepth;
+
+in vec3 QuadPos;
+flat in vec3 SphereCenter;
+flat in float SphereRadius;
+flat in vec3 Color;
+
+out vec4 FragColor;
+
+const vec3 lightDir = normalize(vec3(0.4, 1.0, 0.3));
+
+void main() {
+    // Ray from the eye (view-space origin) through this fragment
+    vec3 dir = normalize(QuadPos);
+    float b = dot(dir, SphereCenter);
+    float h = b * b - dot(SphereCenter, SphereCenter) + SphereRadius * SphereRadius;
+    if (h < 0.0) discard;
+
+    vec3 hit = dir * (b - sqrt(h));
+    vec4 clip = projection * vec4(hit, 1.0);
+    gl_FragDepth = (clip.z / clip.w) * 0.5 + 0.5;
+
+    // The view matrix is a rigid transform, so its transpose takes normals back to world space
+    vec3 normal = transpose(mat3(view)) * ((hit - SphereCenter) / SphereRadius);
+    float diffuse = max(dot(normal, lightDir), 0.0);
+    FragColor = vec4(Color * (0.3 + 0.7 * diffuse), 1.0);
 }
+)";
 
-int main() {
-    if (!glfwInit()) return -1;
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
-    GLFWwindow* window = glfwCreateWindow(screenWidth, screenHeight, "Instanced Spheres", nullptr, nullptr);
-    if (!window) return -1;
-    glfwMakeContextCurrent(window);
+// Sets up the scene described by options and renders it, in a window until closed or headless
+// for options.frames. A headless run also fills run, if given, for the sweep.
+static int runScene(const Options& options, SceneRun* run) {
+    const int screenWidth = options.windowWidth;
+    const int screenHeight = options.windowHeight;
+    auto startupStart = std::chrono::steady_clock::now();
+
+    GLFWwindow* window = nullptr;
+    HeadlessContext headless;
+    if (options.headless) {
+        if (!createHeadlessContext(headless)) return -1;
+    } else {
+        if (!glfwInit()) return -1;
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
+        window = glfwCreateWindow(screenWidth, screenHeight, "Instanced Spheres", nullptr, nullptr);
+        if (!window) return -1;
+        glfwMakeContextCurrent(window);
+    }
 
     glewExperimental = GL_TRUE;
-    if (glewInit() != GLEW_OK) return -1;
+    // A GLX-based GLEW reports a missing X display under EGL, but the GL entry points are loaded by then.
+    GLenum glewStatus = glewInit();
+    if (glewStatus != GLEW_OK && !(options.headless && glewStatus == GLEW_ERROR_NO_GLX_DISPLAY)) return -1;
+
+    if (options.headless && !createHeadlessFramebuffer(headless, screenWidth, screenHeight)) return -1;
+
+    // Every program goes through here, so the startup report covers all shader builds
+    ProgramCache programs;
+    createProgramCache(programs, options.shaderCache);
+
+    NormalMode normalMode = options.normalMode;
+    if (normalMode == NormalMode::Auto) {
+        // InstanceData only carries a uniform scale, so the rotation alone is a valid normal matrix
+        normalMode = NormalMode::UniformScale;
+    }
 
-    // Sphere data
+    // Programs known up front are submitted first and compile (on the driver's threads, where
+    // it has KHR_parallel_shader_compile) while the meshes and instances are generated
+    std::string normalDefines = normalMode == NormalMode::Inverse     ? "#define NORMAL_MODE NORMAL_INVERSE\n"
+                              : normalMode == NormalMode::Precomputed ? "#define NORMAL_MODE NORMAL_PRECOMPUTED\n"
+                                                                      : "#define NORMAL_MODE NORMAL_UNIFORM_SCALE\n";
+    std::string instanceDefines = options.procedural ? instanceGridSource : "";
+    GLuint shaderProgram = options.impostors
+        ? submitProgram(programs, {{GL_VERTEX_SHADER, impostorVertexShaderSource, cameraBlockSource + instanceDefines},
+                                  {GL_FRAGMENT_SHADER, impostorFragmentShaderSource, cameraBlockSource}})
+        : submitProgram(programs, {{GL_VERTEX_SHADER, vertexShaderSource, cameraBlockSource + instanceDefines + normalDefines},
+                                  {GL_FRAGMENT_SHADER, fragmentShaderSource, cameraBlockSource}});
+
+    // Occlusion culling renders into a framebuffer whose depth it can sample, then copies the color out
+    HiZBuffer hiz;
+    GLuint outputFramebuffer = options.headless ? headless.fbo : 0;
+    bool gpuOcclusion = options.occlusion && options.cullMode == CullMode::Gpu;
+    if (gpuOcclusion && !createHiZBuffer(hiz, programs, screenWidth, screenHeight)) return -1;
+
+    // Sphere data, coarsest LOD first
     std::vector<float> vertices;
     std::vector<unsigned int> indices;
-    generateSphere(vertices, indices, 4, 4);
+    std::vector<MeshLod> lods;
+    if (options.impostors) {
+        lods.push_back(generateImpostorQuad(vertices, indices));
+    } else {
+        // Both sets roughly quadruple the triangle count per level
+        std::vector<unsigned int> details = options.sphereMesh == SphereMesh::Icosphere ? std::vector<unsigned int>{0, 1, 2, 3}
+                                                                                        : std::vector<unsigned int>{4, 8, 16, 32};
+        if (!options.lod) details = {options.sphereDetail >= 0 ? (unsigned int)options.sphereDetail : details[0]};
+        lods = generateSphereLods(vertices, indices, options.sphereMesh, details, options.meshOptimize, options.strips);
+        reportLodVertexCache(lods, indices, options.sphereMesh, options.strips);
+    }
+    GLenum primitive = options.impostors || options.strips ? GL_TRIANGLE_STRIP : GL_TRIANGLES;
+    // Spheres are far below 65535 vertices, so this is normally 16-bit
+    PackedIndices packedIndices = packIndices(indices);
+    LodSelector lodSelector = makeLodSelector(lods, options.lodEdgePixels);
 
     GLuint VAO, VBO, EBO;
     glGenVertexArrays(1, &VAO);
@@ -142,73 +260,108 @@ int main() {
 
     glGenBuffers(1, &EBO);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, packedIndices.data.size(), packedIndices.data.data(), GL_STATIC_DRAW);
 
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
+    setupMeshAttributes();
 
-    const int numObj_x = 30;
-    const int numObj_y = 30;
-    const int numObj_z = 30;
+    const int numObj_x = options.gridX;
+    const int numObj_y = options.gridY;
+    const int numObj_z = options.gridZ;
 
-    constexpr int instanceCount = numObj_x * numObj_y * numObj_z;
-    std::vector<InstanceData> instanceData(instanceCount);
+    // parseOptions keeps the product within maxGridInstances
+    const GLuint instanceCount = (GLuint)numObj_x * numObj_y * numObj_z;
+    const float spread = options.spread;
 
+    const float cameraDist = spread * numObj_x * 1.5f;
+    const float camSpead2 = 0.5f;
 
-    constexpr float spread = 1.15f;
+    ThreadPool threadPool(options.threads);
+
+    // RGBA8 stores [0, 1], so the color gradient is spread over the grid instead of saturating.
+    // Procedural instances are generated by the vertex shader instead.
+    InstanceGrid grid = {numObj_x, numObj_y, numObj_z, spread, 0.33f};
+    auto generateStart = std::chrono::steady_clock::now();
+    std::vector<InstanceData> instanceData;
+    if (!options.procedural) generateInstanceGrid(instanceData, grid, threadPool);
+    double generateMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - generateStart).count();
+
+    // CPU-simulated instances have to be re-sent every frame; --cull cpu sends only the visible ones itself
+    bool streamInstances = options.stream || (options.simMode == SimMode::Cpu && options.cullMode != CullMode::Cpu);
+
+    // Streamed instances are rewritten every frame into a persistently mapped ring
+    GLuint instanceVBO = 0;
+    InstanceStream instanceStream;
+    if (streamInstances) {
+        if (!createInstanceStream(instanceStream, instanceCount)) return -1;
+        glBindBuffer(GL_ARRAY_BUFFER, instanceStream.buffer);
+    } else if (!options.procedural) {
+        glGenBuffers(1, &instanceVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glBufferData(GL_ARRAY_BUFFER, instanceCount * sizeof(InstanceData), instanceData.data(), GL_STATIC_DRAW);
+    }
+    GLuint instanceSource = streamInstances ? instanceStream.buffer : instanceVBO;
 
-    constexpr float cameraDist = spread * numObj_x * 1.5f;
-    const float camSpead2 = 0.5f;
+    if (!options.procedural) setupInstanceAttributes();
+    pollPrograms(programs);
 
-    for (int i = 0; i < numObj_x; i++)
-    {
-        for (int j = 0; j < numObj_y; j++)
+    // Per-instance normal matrices, only uploaded when the shader reads them
+    GLuint normalMatrixVBO = 0;
+    if (normalMode == NormalMode::Precomputed && !options.impostors) {
+        std::vector<glm::mat3> normalMatrices(instanceCount);
+        for (GLuint i = 0; i < instanceCount; ++i) {
+            normalMatrices[i] = glm::transpose(glm::inverse(glm::mat3(instanceModelMatrix(instanceData[i]))));
+        }
+
+        glGenBuffers(1, &normalMatrixVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, normalMatrixVBO);
+        glBufferData(GL_ARRAY_BUFFER, instanceCount * sizeof(glm::mat3), normalMatrices.data(), GL_STATIC_DRAW);
+
+        for (int i = 0; i < 3; ++i)
         {
-            for (int k = 0; k < numObj_z; k++)
-            {
-                float x = (-numObj_x / 2.0f) * spread + spread * i;
-                float y = spread * j + spread;
-                float z = (-numObj_z / 2.0f) * spread + spread * k;
-
-                glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(x, y, z));
-                model = glm::scale(model, glm::vec3(0.33f));
-                glm::vec3 color = glm::vec3(0.1f * (i+1), 0.1f * (j+1), 0.1f * (k+1));
-
-                int index = i * (numObj_y * numObj_z) + j * numObj_z + k;
-                instanceData[index] = {model, color};
-            }
+            glVertexAttribPointer(5 + i, 3, GL_FLOAT, GL_FALSE, sizeof(glm::mat3), (void *)(sizeof(glm::vec3) * i));
+            glEnableVertexAttribArray(5 + i);
+            glVertexAttribDivisor(5 + i, 1);
         }
     }
 
-    GLuint instanceVBO;
-    glGenBuffers(1, &instanceVBO);
-    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
-    glBufferData(GL_ARRAY_BUFFER, instanceCount * sizeof(InstanceData), instanceData.data(), GL_STATIC_DRAW);
-
-    // Set up the instance data for the model and color
-    for (int i = 0; i < 4; ++i)
-    {
-        glVertexAttribPointer(2 + i, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void *)(sizeof(glm::vec4) * i));
-        glEnableVertexAttribArray(2 + i);
-        glVertexAttribDivisor(2 + i, 1); // Tell OpenGL to use instanced data
+
+    GpuCuller gpuCuller;
+    CpuCuller cpuCuller;
+    // The sphere generators build unit spheres
+    if (options.cullMode == CullMode::Gpu && !createGpuCuller(gpuCuller, programs, VBO, EBO, lods, instanceSource, instanceCount, 1.0f, options.occlusion)) return -1;
+    if (options.cullMode == CullMode::Cpu && !createCpuCuller(cpuCuller, VBO, EBO, lods, instanceData, 1.0f, threadPool)) return -1;
+    if (options.cullMode == CullMode::Cpu && options.occlusion) enableCpuOcclusion(cpuCuller, screenWidth, screenHeight, lods);
+    cpuCuller.sortMode = options.sortMode;
+    double lastCullMs = 0.0;
+    double lastUploadMs = 0.0;
+
+    // A sorted stream is written in drawOrder, which each frame re-sorts from the last frame's order
+    std::vector<uint32_t> drawOrder;
+    InstanceBounds drawOrderBounds;
+    DepthSorter depthSorter;
+    if (streamInstances && options.sortMode != SortMode::None) {
+        drawOrder.resize(instanceCount);
+        for (GLuint i = 0; i < instanceCount; ++i) drawOrder[i] = i;
+        updateInstanceBounds(drawOrderBounds, instanceData, 1.0f, threadPool);
     }
 
-    // Color is a 3-element vector, which is handled separately
-    glVertexAttribPointer(6, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void *)(sizeof(glm::mat4)));
-    glEnableVertexAttribArray(6);
-    glVertexAttribDivisor(6, 1); // Tell OpenGL to use instanced data for color
-
-    GLuint vertexShader = compileShader(GL_VERTEX_SHADER, vertexShaderSource);
-    GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, fragmentShaderSource);
-    GLuint shaderProgram = glCreateProgram();
-    glAttachShader(shaderProgram, vertexShader);
-    glAttachShader(shaderProgram, fragmentShader);
-    glLinkProgram(shaderProgram);
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
-    glUseProgram(shaderProgram);
+    Profiler profiler;
+    if (options.profile || !options.tracePath.empty()) createProfiler(profiler, !options.tracePath.empty());
+
+    // Depth-passing fragments of each frame, for the overdraw report
+    GLuint samplesQuery = 0;
+    if (options.headless) glGenQueries(1, &samplesQuery);
+
+    // Bounces inside the grid's box, one spacing larger on every side
+    ParticleSim sim;
+    GpuParticleSim gpuSim;
+    double lastSimMs = 0.0;
+    float lastSimTime = -1.0f;
+    if (options.simMode != SimMode::None) {
+        glm::vec3 simMax((numObj_x / 2.0f + 1.0f) * spread, (numObj_y + 1.0f) * spread, (numObj_z / 2.0f + 1.0f) * spread);
+        initParticleSim(sim, instanceData, 1.0f, glm::vec3(-simMax.x, 0.0f, -simMax.z), simMax, 3.0f);
+    }
+    if (options.simMode == SimMode::Gpu) createGpuParticleSim(gpuSim, programs, sim, instanceVBO);
 
     glm::mat4 projection = glm::perspective(glm::radians(60.0f), (float)screenWidth / screenHeight, 0.1f, 1000.0f);
     
@@ -218,42 +371,339 @@ int main() {
     glm::vec3 upDirection = glm::vec3(0.0f, 0.0f, -1.0f);
     glm::mat4 view = glm::lookAt(cameraPos, targetPos, upDirection);
 
-    GLint viewLoc = glGetUniformLocation(shaderProgram, "view");
-    GLint projectionLoc = glGetUniformLocation(shaderProgram, "projection");
+    // Bound once; setCamera and uploadCamera skip the work when nothing moved
+    CameraBuffer camera;
+    createCameraBuffer(camera);
+
+    // Clicks in the window (or --pick after a headless run) select the sphere under the cursor
+    Picker picker;
+    bool picking = !options.procedural && (!options.headless || options.pickX >= 0);
+    if (picking) createPicker(picker, instanceData, 1.0f, threadPool);
+    int pickedInstance = -1;
+    uint32_t pickedColor = 0;   // the picked instance's own color, restored when another is picked
+
+    auto pickAt = [&](float x, float y) {
+        // Simulated spheres have moved since the BVH was built
+        if (options.simMode != SimMode::None) {
+            if (options.simMode == SimMode::Gpu) {
+                glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+                glGetBufferSubData(GL_ARRAY_BUFFER, 0, instanceCount * sizeof(InstanceData), instanceData.data());
+            } else {
+                writeParticleInstances(sim, instanceData, instanceData, threadPool);
+            }
+            updatePicker(picker, instanceData, 1.0f, threadPool);
+        }
+
+        uint32_t instance;
+        float distance;
+        auto pickStart = std::chrono::steady_clock::now();
+        bool hit = pickInstance(picker, view, projection, x, y, screenWidth, screenHeight, instance, distance);
+        double pickMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - pickStart).count();
+
+        // Highlight by rewriting just the color, which no simulation touches; culling and
+        // streaming pick it up from instanceData
+        auto setColor = [&](int index, uint32_t color) {
+            instanceData[index].color = color;
+            if (instanceVBO) {
+                glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+                glBufferSubData(GL_ARRAY_BUFFER, index * sizeof(InstanceData) + offsetof(InstanceData, color), sizeof(uint32_t), &color);
+            }
+        };
+        if (pickedInstance >= 0) setColor(pickedInstance, pickedColor);
+        pickedInstance = -1;
+        if (!hit) {
+            std::cout << "Pick (" << x << ", " << y << "): nothing (" << pickMs << " ms)" << std::endl;
+            return;
+        }
+
+        pickedInstance = (int)instance;
+        pickedColor = instanceData[instance].color;
+        glm::vec4 color = instanceColor(instanceData[instance]);
+        int i = instance / (numObj_y * numObj_z), j = instance / numObj_z % numObj_y, k = instance % numObj_z;
+        std::cout << "Pick (" << x << ", " << y << "): instance " << instance << " (i " << i << ", j " << j << ", k " << k
+                  << "), color (" << color.x << ", " << color.y << ", " << color.z << "), distance " << distance
+                  << " (" << pickMs << " ms)" << std::endl;
+        setColor(pickedInstance, 0xFFFFFFFFu);     // RGBA8 white
+    };
+
+    // Culling and LOD bucketing reorder instances, so visibility must not depend on draw order
+    glEnable(GL_DEPTH_TEST);
+    // Strips are separated by the index type's maximum value
+    if (options.strips) glEnable(GL_PRIMITIVE_RESTART_FIXED_INDEX);
 
     //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
 
-    while (!glfwWindowShouldClose(window)) {
+    auto renderFrame = [&](float timeSinceStart) {
+        beginProfilerFrame(profiler);
+        beginProfileScope(profiler, "frame", false);
+        beginProfileScope(profiler, "clear");
+        if (gpuOcclusion) glBindFramebuffer(GL_FRAMEBUFFER, hiz.framebuffer);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        float timeSinceStart = glutGet(GLUT_ELAPSED_TIME) / 1000.0f;
-        //int deltaTime = timeSinceStart - oldTimeSinceStart;
-        //oldTimeSinceStart = timeSinceStart;
+        endProfileScope(profiler);
 
         constexpr float camera_speed = 0.1f;
-        constexpr float camera_radius = cameraDist;
+        const float camera_radius = cameraDist;
 
         cameraPos.x = sin(timeSinceStart * camera_speed) * -camera_radius;
         cameraPos.z = cos(timeSinceStart * camera_speed) * camera_radius; 
 
         view = glm::lookAt(cameraPos, targetPos, upDirection);
+        updateLodCamera(lodSelector, cameraPos, projection, screenHeight);
+
+        float simDt = lastSimTime < 0.0f ? 0.0f : std::min(timeSinceStart - lastSimTime, 0.05f);
+        lastSimTime = timeSinceStart;
+        if (options.simMode == SimMode::Gpu) {
+            beginProfileScope(profiler, "sim");
+            stepGpuParticleSim(gpuSim, simDt);
+            glUseProgram(shaderProgram);
+            endProfileScope(profiler);
+        } else if (options.simMode == SimMode::Cpu) {
+            beginProfileScope(profiler, "sim", false);
+            auto simStart = std::chrono::steady_clock::now();
+            stepParticleSim(sim, simDt, threadPool);
+            if (options.cullMode == CullMode::Cpu) {
+                // The CPU culler reads instanceData and its own bounds copy
+                writeParticleInstances(sim, instanceData, instanceData, threadPool);
+                updateInstanceBounds(cpuCuller.bounds, instanceData, 1.0f, threadPool);
+            }
+            lastSimMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - simStart).count();
+            endProfileScope(profiler);
+        }
 
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, &view[0][0]);
-        glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, &projection[0][0]);
+        if (streamInstances) {
+            beginProfileScope(profiler, "upload", false);
+            // Includes any wait for the GPU to release the segment
+            auto uploadStart = std::chrono::steady_clock::now();
+            std::span<InstanceData> frameInstances = beginInstanceStreamFrame(instanceStream);
+            if (options.simMode == SimMode::Cpu) {
+                writeParticleInstances(sim, instanceData, frameInstances, threadPool);
+            } else if (!drawOrder.empty()) {
+                sortByDepth(depthSorter, drawOrder, drawOrderBounds, view, options.sortMode, threadPool);
+                threadPool.parallelForRange(instanceCount, 16384, [&](size_t begin, size_t end) {
+                    for (size_t i = begin; i < end; ++i) frameInstances[i] = instanceData[drawOrder[i]];
+                });
+            } else {
+                threadPool.parallelForRange(instanceCount, 16384, [&](size_t begin, size_t end) {
+                    std::copy(instanceData.begin() + begin, instanceData.begin() + end, frameInstances.begin() + begin);
+                });
+            }
+            gpuCuller.instanceOffset = instanceStreamOffset(instanceStream);
+            lastUploadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - uploadStart).count();
+            endProfileScope(profiler);
+        }
 
-        glBindVertexArray(VAO);
-        glDrawElementsInstanced(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0, instanceCount);
+        if (options.cullMode == CullMode::Gpu) {
+            beginProfileScope(profiler, "cull");
+            dispatchGpuCulling(gpuCuller, extractFrustum(projection * view), lodSelector,
+                               gpuOcclusion ? CullPass::Early : CullPass::Single);
+            glUseProgram(shaderProgram);
+            endProfileScope(profiler);
+        } else if (options.cullMode == CullMode::Cpu) {
+            beginProfileScope(profiler, "cull", false);
+            auto cullStart = std::chrono::steady_clock::now();
+            cullAndUploadCpu(cpuCuller, instanceData, view, projection, lodSelector, threadPool);
+            lastCullMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - cullStart).count();
+            endProfileScope(profiler);
+        }
+
+        beginProfileScope(profiler, "camera");
+        setCamera(camera, view, projection);
+        uploadCamera(camera);
+        endProfileScope(profiler);
+
+        beginProfileScope(profiler, "draw");
+        if (samplesQuery) glBeginQuery(GL_SAMPLES_PASSED, samplesQuery);
+
+        if (gpuOcclusion) {
+            // Last frame's visible set lays down the depth the rest is tested against
+            drawGpuCulled(gpuCuller, primitive, packedIndices.type, CullPass::Early);
+            beginProfileScope(profiler, "hi-z pyramid");
+            buildHiZPyramid(hiz, projection * view);
+            endProfileScope(profiler);
+            dispatchGpuCulling(gpuCuller, extractFrustum(projection * view), lodSelector, CullPass::Late, &hiz);
+            glUseProgram(shaderProgram);
+            drawGpuCulled(gpuCuller, primitive, packedIndices.type, CullPass::Late);
+            blitHiZBuffer(hiz, outputFramebuffer);
+        } else if (options.cullMode == CullMode::Gpu) {
+            drawGpuCulled(gpuCuller, primitive, packedIndices.type);
+        } else if (options.cullMode == CullMode::Cpu) {
+            drawCpuCulled(cpuCuller, primitive, packedIndices.type);
+        } else {
+            glBindVertexArray(VAO);
+            glDrawElementsInstancedBaseInstance(primitive, lods[0].indexCount, packedIndices.type, 0, instanceCount,
+                                                streamInstances ? instanceStreamBase(instanceStream) : 0);
+        }
+        if (samplesQuery) glEndQuery(GL_SAMPLES_PASSED);
+        if (streamInstances) endInstanceStreamFrame(instanceStream);
+        endProfileScope(profiler);
+        endProfileScope(profiler);
+    };
 
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+    if (!finishPrograms(programs)) return -1;
+    glUseProgram(shaderProgram);
+    if (options.procedural) setInstanceGridUniforms(shaderProgram, grid);
+
+    // Context creation to first frame; compare runs with and without --shader-cache
+    std::cout << "Startup: " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startupStart).count()
+              << " ms, instance generation: " << generateMs << " ms, shader programs: " << programs.programs << " taking " << programs.buildMs << " ms of the main thread ("
+              << (programs.parallel ? "parallel" : "serial") << " compile";
+    if (programs.directory.empty()) {
+        std::cout << ", no cache)" << std::endl;
+    } else {
+        std::cout << ", " << programs.loaded << " loaded from " << programs.directory << ")" << std::endl;
+    }
+
+    if (options.headless) {
+        std::cout << "Renderer: " << glGetString(GL_RENDERER) << " (" << glGetString(GL_VERSION) << ")\n"
+                  << "Instances: " << instanceCount << ", triangles per instance:";
+        for (const MeshLod& lod : lods) std::cout << " " << lod.triangleCount;
+        std::cout << ", " << screenWidth << "x" << screenHeight << "\n"
+                  << (options.procedural ? std::string("Instances: procedural, no instance buffer")
+                                         : "Instance stride: " + std::to_string(sizeof(InstanceData)) + " bytes" + (streamInstances ? " (streamed)" : "")) << ", "
+                  << (options.impostors ? std::string("ray-cast impostors")
+                                        : std::string("sphere: ") + sphereMeshName(options.sphereMesh) + (options.strips ? " strips" : " triangles")
+                                          + ", normal matrix: " + normalModeName(normalMode))
+                  << ", indices: " << packedIndices.indexSize * 8 << "-bit"
+                  << ", culling: " << cullModeName(options.cullMode) << (options.occlusion ? (gpuOcclusion ? " + Hi-Z occlusion" : " + masked occlusion") : "") << ", sort: " << sortModeName(options.sortMode) << ", simulation: " << simModeName(options.simMode) << ", threads: " << threadPool.size() << std::endl;
+
+        // Fixed time step so every run sees the same camera path
+        constexpr float frameTime = 1.0f / 60.0f;
+        // --max-seconds cuts both the warmup and the timed frames short
+        auto runStart = std::chrono::steady_clock::now();
+        auto outOfTime = [&]() {
+            return options.maxSeconds > 0.0f &&
+                   std::chrono::duration<float>(std::chrono::steady_clock::now() - runStart).count() >= options.maxSeconds;
+        };
+        for (int frame = 0; frame < options.warmupFrames && !outOfTime(); ++frame) {
+            renderFrame(frame * frameTime);
+        }
+        glFinish();
+
+        FrameStats stats;
+        std::vector<double> visibleVertices;
+        runStart = std::chrono::steady_clock::now();
+        for (int frame = 0; frame < options.frames && !(frame > 0 && outOfTime()); ++frame) {
+            auto start = std::chrono::steady_clock::now();
+            renderFrame((options.warmupFrames + frame) * frameTime);
+            beginProfileScope(profiler, "finish", false);
+            glFinish();
+            endProfileScope(profiler);
+            auto end = std::chrono::steady_clock::now();
+
+            // The frame has finished, so reading the GPU counters here does not add a stall
+            std::vector<GLuint> lodCounts = {instanceCount};
+            if (options.cullMode == CullMode::Gpu) {
+                lodCounts = readGpuLodCounts(gpuCuller);
+            } else if (options.cullMode == CullMode::Cpu) {
+                lodCounts.clear();
+                for (const DrawElementsIndirectCommand& command : cpuCuller.commands) lodCounts.push_back(command.instanceCount);
+            }
+
+            size_t visible = 0, triangles = 0, vertices = 0;
+            for (size_t lod = 0; lod < lods.size(); ++lod) {
+                visible += lodCounts[lod];
+                triangles += (size_t)lodCounts[lod] * lods[lod].triangleCount;
+                vertices += (size_t)lodCounts[lod] * lods[lod].vertexCount;
+                if (lods.size() > 1) stats.addCount("lod" + std::to_string(lod) + " instances", lodCounts[lod]);
+            }
+            stats.addFrame(std::chrono::duration<double, std::milli>(end - start).count(), visible, triangles);
+            visibleVertices.push_back((double)vertices);
+            // Every fragment that passed the depth test was shaded; a perfect front-to-back
+            // order shades each covered pixel once
+            GLuint64 samplesPassed = 0;
+            glGetQueryObjectui64v(samplesQuery, GL_QUERY_RESULT, &samplesPassed);
+            stats.addCount("shaded fragments per pixel", (double)samplesPassed / (screenWidth * screenHeight));
+            if (options.occlusion) {
+                size_t inFrustum = gpuOcclusion ? readGpuFrustumVisibleCount(gpuCuller) : cpuCuller.frustumVisibleCount;
+                stats.addCount("occluded instances", inFrustum - visible);
+                stats.addCount("occluded % of frustum-visible", inFrustum ? 100.0 * (inFrustum - visible) / inFrustum : 0.0);
+            }
+            if (options.cullMode == CullMode::Cpu) stats.addTiming("cpu cull", lastCullMs);
+            if (options.simMode == SimMode::Cpu) stats.addTiming("sim", lastSimMs);
+            if (streamInstances) stats.addTiming("upload", lastUploadMs);
+        }
+        reportFrameStats(stats, instanceCount, options.perFrame);
+        if (run) {
+            run->instances = instanceCount;
+            run->trianglesPerInstance = lods.back().triangleCount;
+            size_t instanceSlots = streamInstances ? instanceStreamSegments * instanceStream.capacity : instanceVBO ? instanceCount : 0;
+            run->instanceBufferBytes = instanceSlots * sizeof(InstanceData) + (normalMatrixVBO ? instanceCount * sizeof(glm::mat3) : 0);
+            run->visibleVertices = std::move(visibleVertices);
+            run->residentBytes = residentBytes();
+            run->stats = std::move(stats);
+        }
+        flushProfiler(profiler);
+        printProfileSummary(profiler);
+        if (picking) pickAt((float)options.pickX, (float)options.pickY);
+    } else {
+        bool mouseWasDown = false;
+        while (!glfwWindowShouldClose(window)) {
+            float timeSinceStart = glutGet(GLUT_ELAPSED_TIME) / 1000.0f;
+            //int deltaTime = timeSinceStart - oldTimeSinceStart;
+            //oldTimeSinceStart = timeSinceStart;
+
+            renderFrame(timeSinceStart);
+
+            beginProfileScope(profiler, "swap", false);
+            glfwSwapBuffers(window);
+            endProfileScope(profiler);
+            glfwPollEvents();
+            // Rolling summary every few seconds at 60 Hz
+            if (profiler.enabled && profiler.frame % 300 == 299) printProfileSummary(profiler);
+
+            // Picks with the view just drawn; the cursor is in window coordinates, which differ
+            // from pixels on high-DPI displays
+            bool mouseDown = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+            if (mouseDown && !mouseWasDown) {
+                double cursorX, cursorY;
+                int windowWidth, windowHeight;
+                glfwGetCursorPos(window, &cursorX, &cursorY);
+                glfwGetWindowSize(window, &windowWidth, &windowHeight);
+                pickAt((float)(cursorX * screenWidth / windowWidth), (float)(cursorY * screenHeight / windowHeight));
+            }
+            mouseWasDown = mouseDown;
+        }
     }
 
     glDeleteVertexArrays(1, &VAO);
     glDeleteBuffers(1, &VBO);
     glDeleteBuffers(1, &EBO);
-    glDeleteBuffers(1, &instanceVBO);
+    if (instanceVBO) glDeleteBuffers(1, &instanceVBO);
+    if (instanceStream.buffer) destroyInstanceStream(instanceStream);
+    if (gpuSim.program) destroyGpuParticleSim(gpuSim);
+    if (normalMatrixVBO) glDeleteBuffers(1, &normalMatrixVBO);
+    if (gpuCuller.selectProgram) destroyGpuCuller(gpuCuller);
+    if (hiz.framebuffer) destroyHiZBuffer(hiz);
+    if (cpuCuller.vao) destroyCpuCuller(cpuCuller);
+    if (!options.tracePath.empty()) {
+        flushProfiler(profiler);
+        if (!writeChromeTrace(profiler, options.tracePath)) std::cerr << "Could not write " << options.tracePath << std::endl;
+    }
+    if (profiler.enabled) destroyProfiler(profiler);
+    if (samplesQuery) glDeleteQueries(1, &samplesQuery);
+    destroyCameraBuffer(camera);
     glDeleteProgram(shaderProgram);
-    glfwTerminate();
+    if (options.headless) {
+        destroyHeadlessContext(headless);
+    } else {
+        glfwTerminate();
+    }
     return 0;
 }
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) return -1;
+    if (options.meshReport) {
+        reportSphereMeshes();
+        return 0;
+    }
+    if (options.bvhReport) {
+        ThreadPool threadPool(options.threads);
+        reportBvh(threadPool);
+        return 0;
+    }
+    if (!options.sweepPath.empty()) return runSweep(options, runScene) ? 0 : -1;
+    return runScene(options, nullptr);
+}
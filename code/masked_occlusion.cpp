@@ -0,0 +1,188 @@
+#include "masked_occlusion.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+// Occluders projected per parallel task before the bands rasterize them
+constexpr size_t occluderChunkSize = 1024;
+
+// Whole pixels, inclusive; empty when x0 > x1 or y0 > y1
+struct PixelRect {
+    int x0, y0, x1, y1;
+};
+
+void resizeOcclusionBuffer(MaskedOcclusionBuffer& buffer, int width, int height) {
+    buffer.width = width;
+    buffer.height = height;
+    buffer.tilesX = (width + occlusionTileWidth - 1) / occlusionTileWidth;
+    buffer.tilesY = (height + occlusionTileHeight - 1) / occlusionTileHeight;
+    buffer.tiles.resize((size_t)buffer.tilesX * buffer.tilesY);
+}
+
+void clearOcclusionBuffer(MaskedOcclusionBuffer& buffer, const glm::mat4& view, const glm::mat4& projection) {
+    for (OcclusionTile& tile : buffer.tiles) tile = {{}, FLT_MAX, 0.0f};
+    buffer.view = view;
+    buffer.projectionX = projection[0][0];
+    buffer.projectionY = projection[1][1];
+    buffer.nearPlane = projection[3][2] / (projection[2][2] - 1.0f);
+}
+
+// Bits x0..x1 of a row word
+static uint32_t columnMask(int x0, int x1) {
+    uint32_t upToX1 = x1 >= 31 ? ~0u : (2u << x1) - 1u;
+    return upToX1 & (~0u << x0);
+}
+
+// Pixel position of view-space x (or y) at view depth `depth`
+static float toPixel(float v, float depth, float projection, int size) {
+    return (v * projection / depth * 0.5f + 0.5f) * size;
+}
+
+// A camera-facing disc projected to the screen: an ellipse, axis-aligned since the projection
+// is symmetric
+struct OccluderDisc {
+    float centerX, centerY;     // pixels
+    float radiusX, radiusY;     // pixels
+    float depth;
+    PixelRect rows;             // y0..y1 rows with covered pixels; x0..x1 bound them
+};
+
+static bool projectOccluder(const MaskedOcclusionBuffer& buffer, const glm::vec4& occluder, OccluderDisc& disc) {
+    glm::vec4 v = buffer.view * glm::vec4(glm::vec3(occluder), 1.0f);
+    disc.depth = -v.z;
+    if (disc.depth < buffer.nearPlane) return false;
+
+    disc.centerX = toPixel(v.x, disc.depth, buffer.projectionX, buffer.width);
+    disc.centerY = toPixel(v.y, disc.depth, buffer.projectionY, buffer.height);
+    disc.radiusX = occluder.w * buffer.projectionX / disc.depth * 0.5f * buffer.width;
+    disc.radiusY = occluder.w * buffer.projectionY / disc.depth * 0.5f * buffer.height;
+
+    // Pixel p spans [p, p + 1]; only pixels entirely inside the disc count as covered
+    PixelRect& rect = disc.rows;
+    rect.x0 = (int)std::max(std::ceil(disc.centerX - disc.radiusX), 0.0f);
+    rect.x1 = (int)std::min(std::floor(disc.centerX + disc.radiusX) - 1.0f, buffer.width - 1.0f);
+    rect.y0 = (int)std::max(std::ceil(disc.centerY - disc.radiusY), 0.0f);
+    rect.y1 = (int)std::min(std::floor(disc.centerY + disc.radiusY) - 1.0f, buffer.height - 1.0f);
+    return rect.x0 <= rect.x1 && rect.y0 <= rect.y1;
+}
+
+// Pixels of row y entirely inside the disc, as an inclusive column range (empty if x0 > x1)
+static void discRowSpan(const OccluderDisc& disc, int y, int& x0, int& x1, int width) {
+    // The row's edge farther from the center bounds the chord
+    float dy = std::max(std::abs(y - disc.centerY), std::abs(y + 1 - disc.centerY)) / disc.radiusY;
+    float halfChord = dy < 1.0f ? disc.radiusX * std::sqrt(1.0f - dy * dy) : -1.0f;
+    x0 = (int)std::max(std::ceil(disc.centerX - halfChord), 0.0f);
+    x1 = (int)std::min(std::floor(disc.centerX + halfChord) - 1.0f, width - 1.0f);
+}
+
+// Merges an occluder covering `coverage` at depth z into the tile. validColumns and validRows
+// exclude the parts of edge tiles that lie outside the buffer.
+static void renderTileOccluder(OcclusionTile& tile, const uint32_t* coverage, uint32_t validColumns, int validRows, float z) {
+    if (z >= tile.zMax0) return;
+
+    bool hasWorkingLayer = false;
+    for (int row = 0; row < occlusionTileHeight; ++row) hasWorkingLayer |= tile.mask[row] != 0;
+
+    // Merging pushes the working layer back to z; when z is nearer the tile's far depth than the
+    // working layer, restarting the layer from this occluder loses less
+    if (hasWorkingLayer && z - tile.zMax1 > tile.zMax0 - z) {
+        std::fill(std::begin(tile.mask), std::end(tile.mask), 0u);
+        hasWorkingLayer = false;
+    }
+    tile.zMax1 = hasWorkingLayer ? std::max(tile.zMax1, z) : z;
+
+    bool full = true;
+    for (int row = 0; row < occlusionTileHeight; ++row) {
+        tile.mask[row] |= coverage[row];
+        if (row < validRows && (tile.mask[row] & validColumns) != validColumns) full = false;
+    }
+    if (full) {
+        tile.zMax0 = tile.zMax1;
+        tile.zMax1 = 0.0f;
+        std::fill(std::begin(tile.mask), std::end(tile.mask), 0u);
+    }
+}
+
+void renderOccluderSpheres(MaskedOcclusionBuffer& buffer, const std::vector<glm::vec4>& occluders, ThreadPool& pool) {
+    std::vector<OccluderDisc> discs(occluders.size());
+    pool.parallelForRange(occluders.size(), occluderChunkSize, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            if (!projectOccluder(buffer, occluders[i], discs[i])) discs[i].rows = {1, 1, 0, 0};
+        }
+    });
+
+    // Each task owns one row of tiles and walks the occluders in order, so the result does not
+    // depend on the thread count
+    pool.parallelFor((size_t)buffer.tilesY, [&](size_t tileY) {
+        int bandY0 = (int)tileY * occlusionTileHeight;
+        int bandY1 = bandY0 + occlusionTileHeight - 1;
+        int validRows = std::min(occlusionTileHeight, buffer.height - bandY0);
+        OcclusionTile* tileRow = &buffer.tiles[tileY * buffer.tilesX];
+
+        for (const OccluderDisc& disc : discs) {
+            const PixelRect& rect = disc.rows;
+            if (rect.x0 > rect.x1 || rect.y1 < bandY0 || rect.y0 > bandY1) continue;
+
+            // Covered span of every row of the band
+            int spanX0[occlusionTileHeight], spanX1[occlusionTileHeight];
+            for (int row = 0; row < occlusionTileHeight; ++row) {
+                int y = bandY0 + row;
+                if (y < rect.y0 || y > rect.y1) {
+                    spanX0[row] = 1;
+                    spanX1[row] = 0;
+                } else {
+                    discRowSpan(disc, y, spanX0[row], spanX1[row], buffer.width);
+                }
+            }
+
+            for (int tileX = rect.x0 / occlusionTileWidth; tileX <= rect.x1 / occlusionTileWidth; ++tileX) {
+                int tileX0 = tileX * occlusionTileWidth;
+                uint32_t coverage[occlusionTileHeight];
+                for (int row = 0; row < occlusionTileHeight; ++row) {
+                    int x0 = std::max(spanX0[row] - tileX0, 0);
+                    int x1 = std::min(spanX1[row] - tileX0, occlusionTileWidth - 1);
+                    coverage[row] = x0 <= x1 ? columnMask(x0, x1) : 0u;
+                }
+
+                uint32_t validColumns = columnMask(0, std::min(buffer.width - 1 - tileX0, occlusionTileWidth - 1));
+                renderTileOccluder(tileRow[tileX], coverage, validColumns, validRows, disc.depth);
+            }
+        }
+    });
+}
+
+bool sphereOccluded(const MaskedOcclusionBuffer& buffer, const glm::vec3& center, float radius) {
+    glm::vec4 v = buffer.view * glm::vec4(center, 1.0f);
+    float nearest = -v.z - radius;
+    float farthest = -v.z + radius;
+    if (nearest <= buffer.nearPlane) return false;
+
+    // x/depth over the sphere's view-space bounding box is extreme at its corners
+    float xMin = std::min(toPixel(v.x - radius, nearest, buffer.projectionX, buffer.width), toPixel(v.x - radius, farthest, buffer.projectionX, buffer.width));
+    float xMax = std::max(toPixel(v.x + radius, nearest, buffer.projectionX, buffer.width), toPixel(v.x + radius, farthest, buffer.projectionX, buffer.width));
+    float yMin = std::min(toPixel(v.y - radius, nearest, buffer.projectionY, buffer.height), toPixel(v.y - radius, farthest, buffer.projectionY, buffer.height));
+    float yMax = std::max(toPixel(v.y + radius, nearest, buffer.projectionY, buffer.height), toPixel(v.y + radius, farthest, buffer.projectionY, buffer.height));
+    if (xMax < 0.0f || yMax < 0.0f || xMin >= buffer.width || yMin >= buffer.height) return false;
+
+    PixelRect rect = {(int)std::max(xMin, 0.0f), (int)std::max(yMin, 0.0f),
+                      (int)std::min(xMax, buffer.width - 1.0f), (int)std::min(yMax, buffer.height - 1.0f)};
+    for (int tileY = rect.y0 / occlusionTileHeight; tileY <= rect.y1 / occlusionTileHeight; ++tileY) {
+        int tileY0 = tileY * occlusionTileHeight;
+        int row0 = std::max(rect.y0 - tileY0, 0);
+        int row1 = std::min(rect.y1 - tileY0, occlusionTileHeight - 1);
+        for (int tileX = rect.x0 / occlusionTileWidth; tileX <= rect.x1 / occlusionTileWidth; ++tileX) {
+            const OcclusionTile& tile = buffer.tiles[tileY * buffer.tilesX + tileX];
+            if (nearest > tile.zMax0) continue;
+            if (nearest <= tile.zMax1) return false;
+
+            // Nearer than the tile's far depth but behind the working layer: hidden only if the
+            // layer covers every pixel of the rectangle in this tile
+            int tileX0 = tileX * occlusionTileWidth;
+            uint32_t columns = columnMask(std::max(rect.x0 - tileX0, 0), std::min(rect.x1 - tileX0, occlusionTileWidth - 1));
+            uint32_t uncovered = 0;
+            for (int row = row0; row <= row1; ++row) uncovered |= columns & ~tile.mask[row];
+            if (uncovered) return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+#include "thread_pool.h"
+
+// Tile size of MaskedOcclusionBuffer: one 32-bit coverage word per pixel row
+constexpr int occlusionTileWidth = 32;
+constexpr int occlusionTileHeight = 8;
+
+// A 32x8-pixel tile in the style of masked occlusion culling (Andersson et al., "Masked Software
+// Occlusion Culling"): instead of a depth per pixel it keeps a conservative far depth for the
+// whole tile plus a working layer, the pixels it covers and their far depth. Occluders merge into
+// the working layer until it covers the tile, which then becomes the new far depth.
+struct OcclusionTile {
+    uint32_t mask[occlusionTileHeight];     // pixels covered by the working layer, bit x of row y
+    float zMax0;                            // every pixel of the tile is at most this far
+    float zMax1;                            // every pixel in mask is at most this far
+};
+
+// Software depth buffer for CPU occlusion culling, coarse in depth rather than resolution. Depth
+// is view-space distance along the view direction.
+struct MaskedOcclusionBuffer {
+    int width = 0;              // pixels
+    int height = 0;
+    int tilesX = 0;
+    int tilesY = 0;
+    std::vector<OcclusionTile> tiles;
+    glm::mat4 view = glm::mat4(1.0f);
+    float projectionX = 1.0f;   // projection[0][0]
+    float projectionY = 1.0f;   // projection[1][1]
+    float nearPlane = 0.0f;
+};
+
+void resizeOcclusionBuffer(MaskedOcclusionBuffer& buffer, int width, int height);
+
+// Empties every tile and sets the camera the following calls project with. projection must be
+// a symmetric perspective projection.
+void clearOcclusionBuffer(MaskedOcclusionBuffer& buffer, const glm::mat4& view, const glm::mat4& projection);
+
+// Renders spheres as occluders, in order, so the list should run front to back. Each is a center
+// (xyz) and the radius (w) of a ball inside the drawn object, rasterized as the camera-facing disc
+// through its center: everything the disc covers lies behind the object. Bands of tile rows are
+// rasterized in parallel.
+void renderOccluderSpheres(MaskedOcclusionBuffer& buffer, const std::vector<glm::vec4>& occluders, ThreadPool& pool);
+
+// Whether everything under the sphere's screen rectangle is known to be nearer than the sphere.
+bool sphereOccluded(const MaskedOcclusionBuffer& buffer, const glm::vec3& center, float radius);
@@ -0,0 +1,232 @@
+#include "mesh.h"
+#include "mesh_optimizer.h"
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+
+void generateSphere(std::vector<float>& vertices, std::vector<unsigned int>& indices, unsigned int latitudeBands, unsigned int longitudeBands) {
+    const float radius = 1.0f;
+    vertices.clear();
+    indices.clear();
+
+    // Generate vertices and normals
+    for (unsigned int lat = 0; lat <= latitudeBands; ++lat) {
+        float theta = lat * M_PI / latitudeBands;
+        float sinTheta = std::sin(theta);
+        float cosTheta = std::cos(theta);
+
+        for (unsigned int lon = 0; lon <= longitudeBands; ++lon) {
+            float phi = lon * 2.0f * M_PI / longitudeBands;
+            float sinPhi = std::sin(phi);
+            float cosPhi = std::cos(phi);
+
+            float x = cosPhi * sinTheta;
+            float y = cosTheta;
+            float z = sinPhi * sinTheta;
+
+            vertices.push_back(radius * x);
+            vertices.push_back(radius * y);
+            vertices.push_back(radius * z);
+
+            vertices.push_back(x);
+            vertices.push_back(y);
+            vertices.push_back(z);
+        }
+    }
+
+    // Generate indices
+    for (unsigned int lat = 0; lat < latitudeBands; ++lat) {
+        for (unsigned int lon = 0; lon < longitudeBands; ++lon) {
+            unsigned int first = (lat * (longitudeBands + 1)) + lon;
+            unsigned int second = first + longitudeBands + 1;
+
+            indices.push_back(first);
+            indices.push_back(second);
+            indices.push_back(first + 1);
+
+            indices.push_back(second);
+            indices.push_back(second + 1);
+            indices.push_back(first + 1);
+        }
+    }
+}
+
+void generateIcosphere(std::vector<float>& vertices, std::vector<unsigned int>& indices, unsigned int subdivisions) {
+    const float t = (1.0f + std::sqrt(5.0f)) / 2.0f;
+    std::vector<glm::vec3> positions = {
+        {-1, t, 0}, {1, t, 0}, {-1, -t, 0}, {1, -t, 0},
+        {0, -1, t}, {0, 1, t}, {0, -1, -t}, {0, 1, -t},
+        {t, 0, -1}, {t, 0, 1}, {-t, 0, -1}, {-t, 0, 1},
+    };
+    indices = {
+        0, 11, 5,  0, 5, 1,   0, 1, 7,   0, 7, 10,  0, 10, 11,
+        1, 5, 9,   5, 11, 4,  11, 10, 2, 10, 7, 6,  7, 1, 8,
+        3, 9, 4,   3, 4, 2,   3, 2, 6,   3, 6, 8,   3, 8, 9,
+        4, 9, 5,   2, 4, 11,  6, 2, 10,  8, 6, 7,   9, 8, 1,
+    };
+    for (glm::vec3& p : positions) p = glm::normalize(p);
+
+    // Each edge is split once; the midpoint is shared by the two triangles on either side
+    std::unordered_map<uint64_t, unsigned int> midpoints;
+    auto midpoint = [&](unsigned int a, unsigned int b) {
+        uint64_t key = ((uint64_t)std::min(a, b) << 32) | std::max(a, b);
+        auto [it, inserted] = midpoints.try_emplace(key, (unsigned int)positions.size());
+        if (inserted) positions.push_back(glm::normalize(positions[a] + positions[b]));
+        return it->second;
+    };
+
+    std::vector<unsigned int> subdivided;
+    for (unsigned int level = 0; level < subdivisions; ++level) {
+        midpoints.clear();
+        subdivided.clear();
+        for (size_t i = 0; i < indices.size(); i += 3) {
+            unsigned int a = indices[i], b = indices[i + 1], c = indices[i + 2];
+            unsigned int ab = midpoint(a, b), bc = midpoint(b, c), ca = midpoint(c, a);
+            subdivided.insert(subdivided.end(), {a, ab, ca,  b, bc, ab,  c, ca, bc,  ab, bc, ca});
+        }
+        indices.swap(subdivided);
+    }
+
+    // Unit sphere: the normal is the position
+    vertices.clear();
+    for (const glm::vec3& p : positions) {
+        vertices.insert(vertices.end(), {p.x, p.y, p.z, p.x, p.y, p.z});
+    }
+}
+
+const char* sphereMeshName(SphereMesh mesh) {
+    switch (mesh) {
+        case SphereMesh::Uv:        return "uv";
+        case SphereMesh::Icosphere: return "ico";
+    }
+    return "?";
+}
+
+void generateSphereMesh(std::vector<float>& vertices, std::vector<unsigned int>& indices, SphereMesh mesh, unsigned int detail) {
+    if (mesh == SphereMesh::Icosphere) {
+        generateIcosphere(vertices, indices, detail);
+    } else {
+        generateSphere(vertices, indices, detail, detail);
+    }
+}
+
+// Point of triangle abc closest to p (Ericson, Real-Time Collision Detection 5.1.5)
+static glm::vec3 closestPointOnTriangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+    glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+    float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+    if (d1 <= 0.0f && d2 <= 0.0f) return a;
+
+    glm::vec3 bp = p - b;
+    float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+    if (d3 >= 0.0f && d4 <= d3) return b;
+
+    float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) return a + ab * (d1 / (d1 - d3));
+
+    glm::vec3 cp = p - c;
+    float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+    if (d6 >= 0.0f && d5 <= d6) return c;
+
+    float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) return a + ac * (d2 / (d2 - d6));
+
+    float va = d3 * d6 - d5 * d4;
+    if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f) return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+    float denom = 1.0f / (va + vb + vc);
+    return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+SphereMeshStats measureSphereMesh(const std::vector<float>& vertices, const std::vector<unsigned int>& indices) {
+    auto position = [&](unsigned int index) {
+        return glm::vec3(vertices[index * 6], vertices[index * 6 + 1], vertices[index * 6 + 2]);
+    };
+    auto edgeAngle = [](const glm::vec3& a, const glm::vec3& b) {
+        return std::acos(std::clamp(glm::dot(glm::normalize(a), glm::normalize(b)), -1.0f, 1.0f));
+    };
+
+    SphereMeshStats stats;
+    stats.vertexCount = vertices.size() / 6;
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        glm::vec3 a = position(indices[i]), b = position(indices[i + 1]), c = position(indices[i + 2]);
+        if (glm::length(glm::cross(b - a, c - a)) < 1e-7f) {
+            ++stats.degenerateCount;
+            continue;
+        }
+        ++stats.triangleCount;
+
+        // The vertices lie on the sphere, so the deepest point of the triangle is the one nearest the center
+        float nearest = glm::length(closestPointOnTriangle(glm::vec3(0.0f), a, b, c));
+        stats.maxError = std::max(stats.maxError, 1.0f - nearest);
+        stats.maxEdgeAngle = std::max({stats.maxEdgeAngle, edgeAngle(a, b), edgeAngle(b, c), edgeAngle(c, a)});
+    }
+    return stats;
+}
+
+std::vector<MeshLod> generateSphereLods(std::vector<float>& vertices, std::vector<unsigned int>& indices, SphereMesh mesh,
+                                        const std::vector<unsigned int>& details, bool optimize, bool strips) {
+    vertices.clear();
+    indices.clear();
+
+    std::vector<MeshLod> lods;
+    std::vector<float> lodVertices;
+    std::vector<unsigned int> lodIndices;
+    for (unsigned int detail : details) {
+        generateSphereMesh(lodVertices, lodIndices, mesh, detail);
+        if (optimize) {
+            optimizeVertexCache(lodIndices, lodVertices.size() / 6);
+            optimizeVertexFetch(lodVertices, lodIndices, 6);
+        }
+        SphereMeshStats stats = measureSphereMesh(lodVertices, lodIndices);
+        GLuint triangleCount = (GLuint)lodIndices.size() / 3;
+        if (strips) lodIndices = stripifyTriangles(lodIndices);
+        lods.push_back({detail, (GLuint)lodIndices.size(), (GLuint)indices.size(), (GLint)(vertices.size() / 6),
+                        triangleCount, (GLuint)(lodVertices.size() / 6), stats.maxEdgeAngle, stats.maxError});
+        vertices.insert(vertices.end(), lodVertices.begin(), lodVertices.end());
+        indices.insert(indices.end(), lodIndices.begin(), lodIndices.end());
+    }
+    return lods;
+}
+
+MeshLod generateImpostorQuad(std::vector<float>& vertices, std::vector<unsigned int>& indices) {
+    MeshLod quad = {0, 4, (GLuint)indices.size(), (GLint)(vertices.size() / 6), 2, 4, 0.0f, 0.0f};
+    const float corners[4][2] = {{-1.0f, -1.0f}, {1.0f, -1.0f}, {-1.0f, 1.0f}, {1.0f, 1.0f}};
+    for (unsigned int i = 0; i < 4; ++i) {
+        vertices.insert(vertices.end(), {corners[i][0], corners[i][1], 0.0f, 0.0f, 0.0f, 1.0f});
+        indices.push_back(i);
+    }
+    return quad;
+}
+
+PackedIndices packIndices(const std::vector<unsigned int>& indices) {
+    // 0xFFFF is the 16-bit restart index, so it cannot address a vertex
+    unsigned int maxIndex = 0;
+    for (unsigned int index : indices) {
+        if (index != restartIndex) maxIndex = std::max(maxIndex, index);
+    }
+
+    PackedIndices packed;
+    if (maxIndex < 0xFFFF) {
+        packed.type = GL_UNSIGNED_SHORT;
+        packed.indexSize = sizeof(uint16_t);
+        packed.data.resize(indices.size() * sizeof(uint16_t));
+        uint16_t* out = (uint16_t*)packed.data.data();
+        for (size_t i = 0; i < indices.size(); ++i) out[i] = indices[i] == restartIndex ? 0xFFFF : (uint16_t)indices[i];
+    } else {
+        packed.type = GL_UNSIGNED_INT;
+        packed.indexSize = sizeof(uint32_t);
+        packed.data.resize(indices.size() * sizeof(uint32_t));
+        std::memcpy(packed.data.data(), indices.data(), packed.data.size());
+    }
+    return packed;
+}
+
+void setupMeshAttributes() {
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <GL/glew.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Unit UV sphere, interleaved position + normal (6 floats per vertex)
+void generateSphere(std::vector<float>& vertices, std::vector<unsigned int>& indices, unsigned int latitudeBands = 30, unsigned int longitudeBands = 30);
+
+// Unit icosphere: an icosahedron whose triangles are split in four `subdivisions` times,
+// with every vertex shared between its triangles. 10 * 4^n + 2 vertices, 20 * 4^n triangles.
+void generateIcosphere(std::vector<float>& vertices, std::vector<unsigned int>& indices, unsigned int subdivisions);
+
+enum class SphereMesh {
+    Uv,         // generateSphere with equal latitude and longitude bands
+    Icosphere,  // generateIcosphere
+};
+
+const char* sphereMeshName(SphereMesh mesh);
+
+// Generates a unit sphere of the given kind; detail is the band count for Uv and the subdivision level for Icosphere.
+void generateSphereMesh(std::vector<float>& vertices, std::vector<unsigned int>& indices, SphereMesh mesh, unsigned int detail);
+
+// Geometric properties of a unit sphere mesh
+struct SphereMeshStats {
+    size_t vertexCount = 0;
+    size_t triangleCount = 0;       // excluding degenerate triangles
+    size_t degenerateCount = 0;     // zero-area triangles, e.g. at the UV sphere's poles
+    float maxError = 0.0f;          // largest gap between the triangles and the sphere, relative to the radius
+    float maxEdgeAngle = 0.0f;      // longest edge, as the angle it subtends at the center (radians)
+};
+
+SphereMeshStats measureSphereMesh(const std::vector<float>& vertices, const std::vector<unsigned int>& indices);
+
+// One level of detail inside a shared vertex/index buffer
+struct MeshLod {
+    unsigned int detail;    // sphere bands or subdivisions, 0 for the impostor quad
+    GLuint indexCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint triangleCount;
+    GLuint vertexCount;     // distinct vertices
+    float maxEdgeAngle;     // from measureSphereMesh, 0 for the impostor quad
+    float maxError;         // from measureSphereMesh, 0 for the impostor quad (the ray-cast sphere is exact)
+};
+
+// Appends a sphere for each detail level (coarsest first) to shared vertex/index arrays.
+// Indices are relative to each LOD's baseVertex. With optimize, each LOD's triangles are
+// reordered for the post-transform vertex cache and its vertices for linear fetching. With
+// strips, each LOD is a GL_TRIANGLE_STRIP list separated by restartIndex.
+std::vector<MeshLod> generateSphereLods(std::vector<float>& vertices, std::vector<unsigned int>& indices, SphereMesh mesh,
+                                        const std::vector<unsigned int>& details, bool optimize = true, bool strips = false);
+
+// Appends the [-1, 1] quad used by ray-cast sphere impostors, drawn as a 4-index GL_TRIANGLE_STRIP.
+// The corner is stored in the position attribute.
+MeshLod generateImpostorQuad(std::vector<float>& vertices, std::vector<unsigned int>& indices);
+
+// Index data as uploaded to the element buffer: 16-bit unless a vertex index needs more
+struct PackedIndices {
+    GLenum type = GL_UNSIGNED_INT;  // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+    size_t indexSize = 0;           // bytes per index
+    std::vector<uint8_t> data;
+};
+
+// Packs generated indices for upload, mapping restartIndex to the type's fixed restart index.
+PackedIndices packIndices(const std::vector<unsigned int>& indices);
+
+// Points attribute locations 0 (position) and 1 (normal) at the interleaved vertices
+// in the buffer currently bound to GL_ARRAY_BUFFER.
+void setupMeshAttributes();
@@ -0,0 +1,248 @@
+#include "mesh_optimizer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+
+VertexCacheStats analyzeVertexCache(const std::vector<unsigned int>& indices, size_t vertexCount, unsigned int cacheSize) {
+    std::deque<unsigned int> cache;
+    std::vector<bool> referenced(vertexCount, false);
+    size_t transforms = 0, uniqueVertices = 0;
+
+    for (unsigned int index : indices) {
+        if (!referenced[index]) {
+            referenced[index] = true;
+            ++uniqueVertices;
+        }
+        if (std::find(cache.begin(), cache.end(), index) != cache.end()) continue;
+
+        ++transforms;
+        cache.push_back(index);
+        if (cache.size() > cacheSize) cache.pop_front();
+    }
+
+    VertexCacheStats stats;
+    if (indices.size() >= 3) stats.acmr = (float)transforms / (indices.size() / 3);
+    if (uniqueVertices > 0) stats.atvr = (float)transforms / uniqueVertices;
+    return stats;
+}
+
+// Scoring parameters from the paper; the modelled cache is larger than the FIFO used for the
+// metrics, since the score only needs to favour recently used vertices.
+constexpr int forsythCacheSize = 32;
+constexpr float cacheDecayPower = 1.5f;
+constexpr float lastTriangleScore = 0.75f;
+constexpr float valenceBoostScale = 2.0f;
+constexpr float valenceBoostPower = 0.5f;
+
+static float vertexScore(int cachePosition, unsigned int remainingTriangles) {
+    // No triangles left to draw, so there is no point keeping the vertex in the cache
+    if (remainingTriangles == 0) return -1.0f;
+
+    float score = 0.0f;
+    if (cachePosition < 0) {
+        // Not in the cache
+    } else if (cachePosition < 3) {
+        // Used by the last triangle; a fixed score so the next triangle does not just reuse the same edge
+        score = lastTriangleScore;
+    } else {
+        float scaler = 1.0f / (forsythCacheSize - 3);
+        score = std::pow(1.0f - (cachePosition - 3) * scaler, cacheDecayPower);
+    }
+
+    // Prefer vertices with few triangles left, so they are finished and leave the cache
+    return score + valenceBoostScale * std::pow((float)remainingTriangles, -valenceBoostPower);
+}
+
+void optimizeVertexCache(std::vector<unsigned int>& indices, size_t vertexCount) {
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0) return;
+
+    // Vertex -> triangle adjacency, as offsets into one array
+    std::vector<unsigned int> remaining(vertexCount, 0);
+    for (unsigned int index : indices) ++remaining[index];
+    std::vector<size_t> adjacencyOffset(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; ++v) adjacencyOffset[v + 1] = adjacencyOffset[v] + remaining[v];
+    std::vector<uint32_t> adjacency(indices.size());
+    {
+        std::vector<size_t> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+        for (size_t i = 0; i < indices.size(); ++i) adjacency[fill[indices[i]]++] = (uint32_t)(i / 3);
+    }
+
+    std::vector<int> cachePosition(vertexCount, -1);
+    std::vector<float> score(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v) score[v] = vertexScore(-1, remaining[v]);
+
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<float> triangleScore(triangleCount);
+    for (size_t t = 0; t < triangleCount; ++t) {
+        triangleScore[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+    }
+
+    std::vector<unsigned int> output;
+    output.reserve(indices.size());
+    std::vector<unsigned int> cache, newCache;
+    size_t scanStart = 0;
+
+    auto bestOverall = [&]() -> size_t {
+        size_t best = triangleCount;
+        for (size_t t = scanStart; t < triangleCount; ++t) {
+            if (!emitted[t] && (best == triangleCount || triangleScore[t] > triangleScore[best])) best = t;
+        }
+        return best;
+    };
+
+    size_t best = bestOverall();
+    while (best < triangleCount) {
+        emitted[best] = true;
+        const unsigned int* triangle = &indices[best * 3];
+        output.insert(output.end(), triangle, triangle + 3);
+
+        // Take the triangle off its vertices' adjacency lists
+        for (int corner = 0; corner < 3; ++corner) {
+            unsigned int v = triangle[corner];
+            uint32_t* begin = &adjacency[adjacencyOffset[v]];
+            uint32_t* end = begin + remaining[v];
+            uint32_t* found = std::find(begin, end, (uint32_t)best);
+            if (found == end) continue;     // same index twice in one triangle
+            *found = *(end - 1);
+            --remaining[v];
+        }
+
+        // The triangle's vertices move to the front of the cache, the rest shift back
+        newCache.assign(triangle, triangle + 3);
+        for (unsigned int v : cache) {
+            if (v != triangle[0] && v != triangle[1] && v != triangle[2]) newCache.push_back(v);
+        }
+        for (size_t i = forsythCacheSize; i < newCache.size(); ++i) cachePosition[newCache[i]] = -1;
+        if (newCache.size() > (size_t)forsythCacheSize) newCache.resize(forsythCacheSize);
+        cache.swap(newCache);
+
+        // Rescore the cached vertices and evicted ones (whose position is now -1), then their triangles
+        for (size_t i = 0; i < cache.size(); ++i) cachePosition[cache[i]] = (int)i;
+        for (const std::vector<unsigned int>* list : {&cache, &newCache}) {
+            for (unsigned int v : *list) {
+                float newScore = vertexScore(cachePosition[v], remaining[v]);
+                float delta = newScore - score[v];
+                score[v] = newScore;
+                for (size_t a = adjacencyOffset[v]; a < adjacencyOffset[v] + remaining[v]; ++a) triangleScore[adjacency[a]] += delta;
+            }
+        }
+
+        // The next triangle is the best one touching the cache, or the best remaining one
+        best = triangleCount;
+        float bestScore = -1.0f;
+        for (unsigned int v : cache) {
+            for (size_t a = adjacencyOffset[v]; a < adjacencyOffset[v] + remaining[v]; ++a) {
+                uint32_t t = adjacency[a];
+                if (triangleScore[t] > bestScore) {
+                    best = t;
+                    bestScore = triangleScore[t];
+                }
+            }
+        }
+        if (best == triangleCount) {
+            while (scanStart < triangleCount && emitted[scanStart]) ++scanStart;
+            best = bestOverall();
+        }
+    }
+
+    indices.swap(output);
+}
+
+void optimizeVertexFetch(std::vector<float>& vertices, std::vector<unsigned int>& indices, size_t vertexStride) {
+    size_t vertexCount = vertices.size() / vertexStride;
+    const unsigned int unassigned = ~0u;
+    std::vector<unsigned int> remap(vertexCount, unassigned);
+
+    unsigned int next = 0;
+    for (unsigned int& index : indices) {
+        if (remap[index] == unassigned) remap[index] = next++;
+        index = remap[index];
+    }
+    for (unsigned int& newIndex : remap) {
+        if (newIndex == unassigned) newIndex = next++;
+    }
+
+    std::vector<float> reordered(vertices.size());
+    for (size_t v = 0; v < vertexCount; ++v) {
+        std::copy_n(&vertices[v * vertexStride], vertexStride, &reordered[remap[v] * vertexStride]);
+    }
+    vertices.swap(reordered);
+}
+
+std::vector<unsigned int> stripifyTriangles(const std::vector<unsigned int>& indices) {
+    size_t triangleCount = indices.size() / 3;
+
+    // Undirected edge -> triangles using it
+    std::unordered_map<uint64_t, std::vector<uint32_t>> edgeTriangles;
+    auto edgeKey = [](unsigned int a, unsigned int b) { return ((uint64_t)std::min(a, b) << 32) | std::max(a, b); };
+    for (size_t t = 0; t < triangleCount; ++t) {
+        for (int corner = 0; corner < 3; ++corner) {
+            edgeTriangles[edgeKey(indices[t * 3 + corner], indices[t * 3 + (corner + 1) % 3])].push_back((uint32_t)t);
+        }
+    }
+
+    std::vector<bool> used(triangleCount, false);
+
+    // Whether triangle t, drawn as (a, b, c), keeps its original winding
+    auto sameWinding = [&](size_t t, unsigned int a, unsigned int b, unsigned int c) {
+        const unsigned int* tri = &indices[t * 3];
+        for (int r = 0; r < 3; ++r) {
+            if (tri[r] == a && tri[(r + 1) % 3] == b && tri[(r + 2) % 3] == c) return true;
+        }
+        return false;
+    };
+
+    // Extends strip past its last two vertices while an unused neighbour fits the strip's parity
+    auto grow = [&](std::vector<unsigned int>& strip, std::vector<uint32_t>& taken) {
+        for (;;) {
+            unsigned int a = strip[strip.size() - 2], b = strip.back();
+            bool odd = (strip.size() - 2) % 2 == 1;
+            uint32_t next = ~0u;
+            unsigned int third = 0;
+            for (uint32_t t : edgeTriangles[edgeKey(a, b)]) {
+                if (used[t]) continue;
+                const unsigned int* tri = &indices[t * 3];
+                unsigned int c = tri[0] != a && tri[0] != b ? tri[0] : tri[1] != a && tri[1] != b ? tri[1] : tri[2];
+                // GL draws strip triangle k as (k, k+1, k+2), swapping the first two when k is odd
+                if (odd ? sameWinding(t, b, a, c) : sameWinding(t, a, b, c)) {
+                    next = t;
+                    third = c;
+                    break;
+                }
+            }
+            if (next == ~0u) return;
+            used[next] = true;
+            taken.push_back(next);
+            strip.push_back(third);
+        }
+    };
+
+    std::vector<unsigned int> strips, strip, bestStrip;
+    std::vector<uint32_t> taken, bestTaken;
+    for (size_t start = 0; start < triangleCount; ++start) {
+        if (used[start]) continue;
+
+        // Try each rotation of the first triangle and keep the longest strip
+        bestStrip.clear();
+        for (int r = 0; r < 3; ++r) {
+            const unsigned int* tri = &indices[start * 3];
+            strip = {tri[r], tri[(r + 1) % 3], tri[(r + 2) % 3]};
+            taken.clear();
+            used[start] = true;
+            grow(strip, taken);
+            for (uint32_t t : taken) used[t] = false;
+            if (strip.size() > bestStrip.size()) {
+                bestStrip = strip;
+                bestTaken = taken;
+            }
+        }
+        for (uint32_t t : bestTaken) used[t] = true;
+
+        if (!strips.empty()) strips.push_back(restartIndex);
+        strips.insert(strips.end(), bestStrip.begin(), bestStrip.end());
+    }
+    return strips;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+// Post-transform vertex cache behaviour of an indexed triangle list
+struct VertexCacheStats {
+    float acmr = 0.0f;  // average cache miss ratio: vertex shader invocations per triangle (0.5 is ideal for large meshes)
+    float atvr = 0.0f;  // average transform to vertex ratio: invocations per referenced vertex (1.0 is ideal)
+};
+
+// Simulates a FIFO post-transform cache of cacheSize entries over the triangle list.
+VertexCacheStats analyzeVertexCache(const std::vector<unsigned int>& indices, size_t vertexCount, unsigned int cacheSize = 16);
+
+// Reorders triangles for post-transform cache reuse (Tom Forsyth, "Linear-Speed Vertex Cache
+// Optimisation"). Triangle winding is preserved.
+void optimizeVertexCache(std::vector<unsigned int>& indices, size_t vertexCount);
+
+// Renumbers vertices in order of first use so vertex fetches walk the buffer linearly.
+// vertexStride is in floats; unreferenced vertices are moved to the end.
+void optimizeVertexFetch(std::vector<float>& vertices, std::vector<unsigned int>& indices, size_t vertexStride);
+
+// Strip separator in generated index arrays; packIndices maps it to the fixed restart index of the upload type
+constexpr unsigned int restartIndex = ~0u;
+
+// Greedily joins a triangle list into triangle strips separated by restartIndex, for drawing
+// with GL_PRIMITIVE_RESTART_FIXED_INDEX. Strips start in the list's order, so a cache-optimized
+// list stays cache friendly, and only follow neighbours whose winding the strip preserves.
+std::vector<unsigned int> stripifyTriangles(const std::vector<unsigned int>& indices);
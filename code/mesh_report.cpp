@@ -0,0 +1,81 @@
+#include "mesh_report.h"
+#include "mesh.h"
+#include "mesh_optimizer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+static SphereMeshStats measure(SphereMesh mesh, unsigned int detail) {
+    std::vector<float> vertices;
+    std::vector<unsigned int> indices;
+    generateSphereMesh(vertices, indices, mesh, detail);
+    return measureSphereMesh(vertices, indices);
+}
+
+static void printRow(SphereMesh mesh, unsigned int detail, const SphereMeshStats& stats) {
+    std::printf("%-4s %6u %9zu %9zu %10zu %9.4f%% %9.2f\n", sphereMeshName(mesh), detail, stats.vertexCount,
+                stats.triangleCount, stats.degenerateCount, stats.maxError * 100.0f, stats.maxEdgeAngle * 180.0f / (float)M_PI);
+}
+
+void reportSphereMeshes() {
+    std::printf("mesh detail  vertices triangles degenerate max error  max edge (deg)\n");
+    for (unsigned int bands : {4u, 8u, 16u, 32u, 64u}) printRow(SphereMesh::Uv, bands, measure(SphereMesh::Uv, bands));
+    for (unsigned int level = 0; level <= 5; ++level) printRow(SphereMesh::Icosphere, level, measure(SphereMesh::Icosphere, level));
+
+    // Silhouette error in pixels is roughly maxError times the projected radius in pixels,
+    // e.g. 0.5 px on a 50 px sphere needs 1%.
+    std::printf("\ncheapest mesh with max error at or below the target\n");
+    std::printf("target   mesh detail  vertices triangles degenerate max error  max edge (deg)\n");
+    for (float target : {0.1f, 0.03f, 0.01f, 0.003f, 0.001f}) {
+        unsigned int bands = 3;
+        SphereMeshStats uv = measure(SphereMesh::Uv, bands);
+        while (uv.maxError > target) uv = measure(SphereMesh::Uv, ++bands);
+
+        unsigned int level = 0;
+        SphereMeshStats ico = measure(SphereMesh::Icosphere, level);
+        while (ico.maxError > target) ico = measure(SphereMesh::Icosphere, ++level);
+
+        std::printf("%6.1f%%  ", target * 100.0f);
+        printRow(SphereMesh::Uv, bands, uv);
+        std::printf("         ");
+        printRow(SphereMesh::Icosphere, level, ico);
+    }
+}
+
+// Expands strips separated by restartIndex into the triangle list GL draws from them
+static std::vector<unsigned int> triangulateStrips(const std::vector<unsigned int>& strips) {
+    std::vector<unsigned int> triangles;
+    size_t stripStart = 0;
+    for (size_t i = 0; i < strips.size(); ++i) {
+        if (strips[i] == restartIndex) {
+            stripStart = i + 1;
+        } else if (i >= stripStart + 2) {
+            size_t k = i - stripStart - 2;
+            if (k % 2 == 0) {
+                triangles.insert(triangles.end(), {strips[i - 2], strips[i - 1], strips[i]});
+            } else {
+                triangles.insert(triangles.end(), {strips[i - 1], strips[i - 2], strips[i]});
+            }
+        }
+    }
+    return triangles;
+}
+
+void reportLodVertexCache(const std::vector<MeshLod>& lods, const std::vector<unsigned int>& indices, SphereMesh mesh, bool strips) {
+    for (size_t lod = 0; lod < lods.size(); ++lod) {
+        std::vector<unsigned int> lodIndices(indices.begin() + lods[lod].firstIndex,
+                                             indices.begin() + lods[lod].firstIndex + lods[lod].indexCount);
+        if (strips) lodIndices = triangulateStrips(lodIndices);
+        size_t vertexCount = *std::max_element(lodIndices.begin(), lodIndices.end()) + 1;
+        VertexCacheStats drawn = analyzeVertexCache(lodIndices, vertexCount);
+
+        std::vector<float> rawVertices;
+        std::vector<unsigned int> rawIndices;
+        generateSphereMesh(rawVertices, rawIndices, mesh, lods[lod].detail);
+        VertexCacheStats raw = analyzeVertexCache(rawIndices, rawVertices.size() / 6);
+
+        std::printf("LOD %zu (%s %u): ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, %.2f indices/triangle%s\n", lod,
+                    sphereMeshName(mesh), lods[lod].detail, raw.acmr, drawn.acmr, raw.atvr, drawn.atvr,
+                    (float)lods[lod].indexCount / lods[lod].triangleCount, strips ? " (strips)" : "");
+    }
+}
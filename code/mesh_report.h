@@ -0,0 +1,11 @@
+#pragma once
+#include <vector>
+#include "mesh.h"
+
+// Prints vertex/triangle counts and geometric error of the UV sphere and icosphere at several
+// detail levels, then the cheapest detail level of each that meets a series of error targets.
+void reportSphereMeshes();
+
+// Prints the post-transform cache ACMR/ATVR of each LOD as generated and as drawn from indices
+// (triangle lists, or strips separated by restartIndex), and the index count per triangle.
+void reportLodVertexCache(const std::vector<MeshLod>& lods, const std::vector<unsigned int>& indices, SphereMesh mesh, bool strips);
@@ -0,0 +1,333 @@
+#include "options.h"
+#include <algorithm>
+#include <charconv>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string_view>
+
+const char* normalModeName(NormalMode mode) {
+    switch (mode) {
+        case NormalMode::Auto:         return "auto";
+        case NormalMode::Inverse:      return "inverse";
+        case NormalMode::Precomputed:  return "precomputed";
+        case NormalMode::UniformScale: return "uniform";
+    }
+    return "?";
+}
+
+static bool parseNormalMode(std::string_view text, NormalMode& mode) {
+    for (NormalMode m : {NormalMode::Auto, NormalMode::Inverse, NormalMode::Precomputed, NormalMode::UniformScale}) {
+        if (text == normalModeName(m)) {
+            mode = m;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* cullModeName(CullMode mode) {
+    switch (mode) {
+        case CullMode::None: return "none";
+        case CullMode::Gpu:  return "gpu";
+        case CullMode::Cpu:  return "cpu";
+    }
+    return "?";
+}
+
+static bool parseCullMode(std::string_view text, CullMode& mode) {
+    for (CullMode m : {CullMode::None, CullMode::Gpu, CullMode::Cpu}) {
+        if (text == cullModeName(m)) {
+            mode = m;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool parseSphereMesh(std::string_view text, SphereMesh& mesh) {
+    for (SphereMesh m : {SphereMesh::Uv, SphereMesh::Icosphere}) {
+        if (text == sphereMeshName(m)) {
+            mesh = m;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool parseSortMode(std::string_view text, SortMode& mode) {
+    for (SortMode m : {SortMode::None, SortMode::FrontToBack, SortMode::BackToFront}) {
+        if (text == sortModeName(m)) {
+            mode = m;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* simModeName(SimMode mode) {
+    switch (mode) {
+        case SimMode::None: return "none";
+        case SimMode::Cpu:  return "cpu";
+        case SimMode::Gpu:  return "gpu";
+    }
+    return "?";
+}
+
+static bool parseSimMode(std::string_view text, SimMode& mode) {
+    for (SimMode m : {SimMode::None, SimMode::Cpu, SimMode::Gpu}) {
+        if (text == simModeName(m)) {
+            mode = m;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void printUsage(const char* program) {
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "  --headless          render offscreen (EGL + FBO) and print a frame-time report\n"
+              << "  --frames N          number of timed frames in headless mode (default 1000)\n"
+              << "  --warmup N          untimed frames rendered before measuring (default 10)\n"
+              << "  --per-frame         also print each frame's time and visible/culled counts\n"
+              << "  --profile           time CPU and GPU (timestamp query) scopes per frame, print p50/p95/p99\n"
+              << "  --trace FILE        write the profiled scopes as Chrome trace JSON (implies --profile)\n"
+              << "  --pick X,Y          after a headless run, pick the sphere under pixel (X, Y) from the top left and print it\n"
+              << "  --normals MODE      normal matrix source: auto, inverse, precomputed, uniform (default auto)\n"
+              << "  --cull MODE         instance culling: none, gpu, cpu (default none)\n"
+              << "  --occlusion         occlusion culling: two-phase Hi-Z (gpu) or a masked software depth buffer (cpu); needs --cull\n"
+              << "  --sort ORDER        draw order of CPU-written instances by view depth: none, front, back (default none)\n"
+              << "  --sphere MESH       sphere tessellation: uv, ico (default uv)\n"
+              << "  --sphere-detail N   bands (uv) or subdivisions (ico) when not using --lod (default 4 / 0)\n"
+              << "  --no-mesh-opt       keep the generators' triangle and vertex order\n"
+              << "  --strips            draw sphere meshes as triangle strips with primitive restart\n"
+              << "  --mesh-report       compare vertex/triangle counts and error of the sphere meshes, then exit\n"
+              << "  --bvh-report        time BVH build, refit and queries over a million spheres, then exit\n"
+              << "  --stream            rewrite every instance each frame into a triple-buffered persistent mapping\n"
+              << "  --simulate MODE     bounce the spheres around in a particle simulation: none, cpu, gpu (default none)\n"
+              << "  --impostors         draw each sphere as a ray-cast quad instead of a triangle mesh\n"
+              << "  --lod               pick 4 sphere LODs (4/8/16/32 bands or 0-3 subdivisions) by projected size (needs --cull)\n"
+              << "  --lod-pixels PX     longest on-screen edge before switching to a finer LOD (default 8)\n"
+              << "  --threads N         CPU threads for culling and other parallel work, 0 = all cores (default 0)\n"
+              << "  --grid X,Y,Z        spheres along each axis of the grid, at most " << maxGridInstances << " in total (default 30,30,30)\n"
+              << "  --spread F          distance between neighboring sphere centers (default 1.15)\n"
+              << "  --window WxH        window or offscreen framebuffer size (default 800x600)\n"
+              << "  --max-seconds S     end a headless run early once its timed frames took this long, 0 = never (default 0)\n"
+              << "  --procedural        compute the grid's instances in the vertex shader, no instance buffer\n"
+              << "  --shader-cache DIR  keep linked program binaries in DIR and load them instead of compiling\n"
+              << "  --sweep FILE        run headless over a range of instance counts and tessellations, write a CSV\n"
+              << "  --config FILE       read more options from FILE, whitespace-separated, # starts a comment\n";
+}
+
+static bool parseInt(std::string_view text, int& value) {
+    auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+    return ec == std::errc() && ptr == text.data() + text.size();
+}
+
+// "X,Y,Z", all positive and at most maxGridInstances in total
+static bool parseGrid(std::string_view text, int& x, int& y, int& z) {
+    size_t first = text.find(','), second = text.find(',', first + 1);
+    if (first == std::string_view::npos || second == std::string_view::npos) return false;
+    return parseInt(text.substr(0, first), x) && parseInt(text.substr(first + 1, second - first - 1), y) &&
+           parseInt(text.substr(second + 1), z) && x > 0 && y > 0 && z > 0 &&
+           (int64_t)x * y * z <= maxGridInstances;
+}
+
+// "WxH", both positive
+static bool parseSize(std::string_view text, int& width, int& height) {
+    size_t x = text.find('x');
+    return x != std::string_view::npos && parseInt(text.substr(0, x), width) && parseInt(text.substr(x + 1), height) && width > 0 && height > 0;
+}
+
+// "X,Y" with both non-negative
+static bool parsePixel(std::string_view text, int& x, int& y) {
+    size_t comma = text.find(',');
+    return comma != std::string_view::npos && parseInt(text.substr(0, comma), x) && parseInt(text.substr(comma + 1), y) && x >= 0 && y >= 0;
+}
+
+static bool parseFloat(std::string_view text, float& value) {
+    auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+    return ec == std::errc() && ptr == text.data() + text.size();
+}
+
+static bool parseConfigFile(const std::string& path, const char* program, Options& options, std::vector<std::string>& openConfigs);
+
+// Parses args[0..], `program` naming the executable in the usage text. openConfigs holds the
+// config files being read, outermost first.
+static bool parseArgs(const std::vector<std::string>& args, const char* program, Options& options, std::vector<std::string>& openConfigs) {
+    for (size_t i = 0; i < args.size(); ++i) {
+        std::string_view arg = args[i];
+        bool hasValue = i + 1 < args.size();
+
+        if (arg == "--headless") {
+            options.headless = true;
+        } else if (arg == "--frames" && hasValue && parseInt(args[i + 1], options.frames) && options.frames > 0) {
+            ++i;
+        } else if (arg == "--warmup" && hasValue && parseInt(args[i + 1], options.warmupFrames) && options.warmupFrames >= 0) {
+            ++i;
+        } else if (arg == "--per-frame") {
+            options.perFrame = true;
+        } else if (arg == "--profile") {
+            options.profile = true;
+        } else if (arg == "--trace" && hasValue) {
+            options.tracePath = args[++i];
+        } else if (arg == "--pick" && hasValue && parsePixel(args[i + 1], options.pickX, options.pickY)) {
+            ++i;
+        } else if (arg == "--cull" && hasValue && parseCullMode(args[i + 1], options.cullMode)) {
+            ++i;
+        } else if (arg == "--occlusion") {
+            options.occlusion = true;
+        } else if (arg == "--sort" && hasValue && parseSortMode(args[i + 1], options.sortMode)) {
+            ++i;
+        } else if (arg == "--sphere" && hasValue && parseSphereMesh(args[i + 1], options.sphereMesh)) {
+            ++i;
+        } else if (arg == "--sphere-detail" && hasValue && parseInt(args[i + 1], options.sphereDetail) && options.sphereDetail >= 0) {
+            ++i;
+        } else if (arg == "--no-mesh-opt") {
+            options.meshOptimize = false;
+        } else if (arg == "--strips") {
+            options.strips = true;
+        } else if (arg == "--mesh-report") {
+            options.meshReport = true;
+        } else if (arg == "--bvh-report") {
+            options.bvhReport = true;
+        } else if (arg == "--stream") {
+            options.stream = true;
+        } else if (arg == "--simulate" && hasValue && parseSimMode(args[i + 1], options.simMode)) {
+            ++i;
+        } else if (arg == "--impostors") {
+            options.impostors = true;
+        } else if (arg == "--lod") {
+            options.lod = true;
+        } else if (arg == "--lod-pixels" && hasValue && parseFloat(args[i + 1], options.lodEdgePixels) && options.lodEdgePixels > 0.0f) {
+            ++i;
+        } else if (arg == "--threads" && hasValue && parseInt(args[i + 1], options.threads) && options.threads >= 0) {
+            ++i;
+        } else if (arg == "--normals" && hasValue && parseNormalMode(args[i + 1], options.normalMode)) {
+            ++i;
+        } else if (arg == "--grid" && hasValue && parseGrid(args[i + 1], options.gridX, options.gridY, options.gridZ)) {
+            ++i;
+        } else if (arg == "--spread" && hasValue && parseFloat(args[i + 1], options.spread) && options.spread > 0.0f) {
+            ++i;
+        } else if (arg == "--window" && hasValue && parseSize(args[i + 1], options.windowWidth, options.windowHeight)) {
+            ++i;
+        } else if (arg == "--procedural") {
+            options.procedural = true;
+        } else if (arg == "--shader-cache" && hasValue) {
+            options.shaderCache = args[++i];
+        } else if (arg == "--sweep" && hasValue) {
+            options.sweepPath = args[++i];
+        } else if (arg == "--max-seconds" && hasValue && parseFloat(args[i + 1], options.maxSeconds) && options.maxSeconds >= 0.0f) {
+            ++i;
+        } else if (arg == "--config" && hasValue) {
+            if (!parseConfigFile(args[++i], program, options, openConfigs)) return false;
+        } else {
+            std::cerr << "Invalid argument: " << arg << std::endl;
+            printUsage(program);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Whitespace-separated arguments, '#' starting a comment that runs to the end of the line
+static bool parseConfigFile(const std::string& path, const char* program, Options& options, std::vector<std::string>& openConfigs) {
+    // A file that reaches itself through --config would recurse until the stack overflows
+    std::error_code error;
+    std::string canonical = std::filesystem::weakly_canonical(path, error).string();
+    if (error) canonical = path;
+    if (std::find(openConfigs.begin(), openConfigs.end(), canonical) != openConfigs.end()) {
+        std::cerr << "Config file " << path << " includes itself through --config" << std::endl;
+        return false;
+    }
+
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Cannot read config file " << path << std::endl;
+        return false;
+    }
+    std::vector<std::string> args;
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream words(line.substr(0, line.find('#')));
+        for (std::string word; words >> word;) args.push_back(word);
+    }
+    openConfigs.push_back(canonical);
+    bool parsed = parseArgs(args, program, options, openConfigs);
+    openConfigs.pop_back();
+    return parsed;
+}
+
+// Rejects combinations of otherwise valid options, before anything is created for them
+static bool checkOptionCombinations(const Options& options) {
+    if (options.occlusion && options.cullMode == CullMode::None) {
+        std::cerr << "--occlusion needs --cull gpu or --cull cpu" << std::endl;
+        return false;
+    }
+    if (options.lod && options.cullMode == CullMode::None) {
+        std::cerr << "--lod needs --cull gpu or --cull cpu to bucket instances" << std::endl;
+        return false;
+    }
+    // Sorting reorders instances on their way from instanceData to the GPU. The GPU culler and
+    // the simulations compact or rewrite them in their own order, so the depth order would be lost.
+    bool sortedPath = options.cullMode == CullMode::Cpu ||
+                      (options.stream && options.simMode == SimMode::None && options.cullMode == CullMode::None);
+    if (options.sortMode != SortMode::None && !sortedPath) {
+        std::cerr << "--sort needs --cull cpu, or --stream without --simulate" << std::endl;
+        return false;
+    }
+    if (options.lod && options.impostors) {
+        std::cerr << "--lod cannot be combined with --impostors" << std::endl;
+        return false;
+    }
+    if (options.sphereDetail >= 0 && options.lod) {
+        std::cerr << "--sphere-detail cannot be combined with --lod" << std::endl;
+        return false;
+    }
+    if (options.sphereMesh == SphereMesh::Uv ? options.sphereDetail >= 0 && options.sphereDetail < 3 : options.sphereDetail > 8) {
+        std::cerr << "--sphere-detail needs at least 3 bands (uv) or at most 8 subdivisions (ico)" << std::endl;
+        return false;
+    }
+
+    // Procedural instances exist only inside the vertex shader, so nothing on the CPU can cull,
+    // move, reorder or pick them
+    if (options.procedural && (options.cullMode != CullMode::None || options.stream || options.simMode != SimMode::None)) {
+        std::cerr << "--procedural cannot be combined with --cull, --stream or --simulate" << std::endl;
+        return false;
+    }
+    if (options.procedural && (options.normalMode == NormalMode::Precomputed || options.pickX >= 0)) {
+        std::cerr << "--procedural cannot be combined with --normals precomputed or --pick" << std::endl;
+        return false;
+    }
+
+    // Impostors ignore the normal mode, so only meshes get per-instance normal matrices
+    bool normalMatrices = options.normalMode == NormalMode::Precomputed && !options.impostors;
+    bool streamInstances = options.stream || (options.simMode == SimMode::Cpu && options.cullMode != CullMode::Cpu);
+    // The compacted instance buffers would no longer line up with the per-instance normal matrices
+    if (options.cullMode != CullMode::None && normalMatrices) {
+        std::cerr << "--normals precomputed cannot be combined with culling" << std::endl;
+        return false;
+    }
+    // Stream segments are reached through baseInstance, which would offset the normal matrices too
+    if (streamInstances && normalMatrices) {
+        std::cerr << "--normals precomputed cannot be combined with --stream or --simulate cpu" << std::endl;
+        return false;
+    }
+    if (options.stream && options.cullMode == CullMode::Cpu) {
+        std::cerr << "--cull cpu already streams its visible instances; drop --stream" << std::endl;
+        return false;
+    }
+    // The GPU simulation writes instanceVBO, which neither the CPU culler nor a stream would see
+    if (options.simMode == SimMode::Gpu && (options.cullMode == CullMode::Cpu || options.stream)) {
+        std::cerr << "--simulate gpu cannot be combined with --cull cpu or --stream" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool parseOptions(int argc, char** argv, Options& options) {
+    std::vector<std::string> openConfigs;
+    return parseArgs(std::vector<std::string>(argv + 1, argv + argc), argv[0], options, openConfigs) &&
+           checkOptionCombinations(options);
+}
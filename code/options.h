@@ -0,0 +1,79 @@
+#pragma once
+#include "depth_sort.h"
+#include "mesh.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// How the vertex shader obtains the normal matrix
+enum class NormalMode {
+    Auto,           // UniformScale, since InstanceData only stores a uniform scale
+    Inverse,        // transpose(inverse(model)) per vertex
+    Precomputed,    // per-instance mat3 computed on the CPU
+    UniformScale,   // the instance rotation, valid for uniform scale only
+};
+
+const char* normalModeName(NormalMode mode);
+
+// Per-frame visibility culling of instances
+enum class CullMode {
+    None,   // draw every instance
+    Gpu,    // compute-shader frustum culling + glDrawElementsIndirect
+    Cpu,    // multi-threaded SIMD frustum culling, uploads the visible subset
+};
+
+const char* cullModeName(CullMode mode);
+
+// Where instance positions are animated
+enum class SimMode {
+    None,   // static grid
+    Cpu,    // multi-threaded ParticleSim, instances re-sent every frame
+    Gpu,    // compute shader updating the instance buffer in place
+};
+
+const char* simModeName(SimMode mode);
+
+// Largest --grid, in spheres: 3 GB of InstanceData, and the range of the GPU culler's 27-bit slots
+constexpr int64_t maxGridInstances = int64_t(1) << 27;
+
+// Command line options
+struct Options {
+    bool headless = false;      // render offscreen through EGL instead of opening a window
+    int frames = 1000;          // frames rendered in headless mode
+    int warmupFrames = 10;      // frames rendered before timing starts
+    int threads = 0;            // worker threads including the main thread, 0 = all cores
+    bool perFrame = false;      // print every frame's time and visible count in headless mode
+    int pickX = -1;             // pixel picked after a headless run, -1 = none
+    int pickY = -1;
+    bool profile = false;       // time CPU and GPU scopes of each frame and print their percentiles
+    std::string tracePath;      // also write the scopes as a Chrome trace here, empty = no trace
+    NormalMode normalMode = NormalMode::Auto;
+    CullMode cullMode = CullMode::None;
+    bool occlusion = false;     // occlusion culling on top of --cull: Hi-Z on the GPU, masked software depth on the CPU
+    SortMode sortMode = SortMode::None;
+    SphereMesh sphereMesh = SphereMesh::Uv;
+    int sphereDetail = -1;      // bands (uv) or subdivisions (ico) without --lod, -1 = coarsest LOD
+    bool meshOptimize = true;   // reorder mesh triangles and vertices for the post-transform cache
+    bool strips = false;        // draw sphere meshes as triangle strips joined by primitive restart
+    bool meshReport = false;    // print the sphere mesh comparison and exit
+    bool bvhReport = false;     // time the instance BVH on a million spheres and exit
+    bool stream = false;        // rewrite all instances every frame through a persistently mapped ring buffer
+    SimMode simMode = SimMode::None;
+    bool impostors = false;     // ray-cast one quad per sphere instead of drawing a triangle mesh
+    bool lod = false;           // four sphere LODs chosen by projected size (needs culling)
+    float lodEdgePixels = 8.0f; // longest allowed on-screen edge before switching to a finer LOD
+    int gridX = 30;             // spheres along each axis of the grid
+    int gridY = 30;
+    int gridZ = 30;
+    float spread = 1.15f;       // distance between neighboring sphere centers
+    int windowWidth = 800;      // window or headless framebuffer size
+    int windowHeight = 600;
+    float maxSeconds = 0.0f;    // stop a headless run once its timed frames took this long, 0 = run every frame
+    bool procedural = false;    // compute instances from gl_InstanceID and the grid, no instance buffer
+    std::string shaderCache;    // directory of cached program binaries, empty = compile every run
+    std::string sweepPath;      // run the scaling sweep and write its CSV here, empty = normal run
+};
+
+// Parses argv; returns false on unknown or malformed arguments (after printing usage) and on
+// options that cannot be combined (after saying why).
+bool parseOptions(int argc, char** argv, Options& options);
@@ -0,0 +1,64 @@
+#include "particle_sim.h"
+#include <random>
+
+// Particles per parallel task
+constexpr size_t simChunkSize = 16384;
+
+void initParticleSim(ParticleSim& sim, const std::vector<InstanceData>& instances, float meshRadius,
+                     const glm::vec3& boundsMin, const glm::vec3& boundsMax, float maxSpeed) {
+    size_t count = instances.size();
+    for (std::vector<float>* array : {&sim.x, &sim.y, &sim.z, &sim.vx, &sim.vy, &sim.vz, &sim.radius}) array->resize(count);
+    sim.boundsMin = boundsMin;
+    sim.boundsMax = boundsMax;
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> speed(-maxSpeed, maxSpeed);
+    for (size_t i = 0; i < count; ++i) {
+        sim.x[i] = instances[i].position.x;
+        sim.y[i] = instances[i].position.y;
+        sim.z[i] = instances[i].position.z;
+        sim.vx[i] = speed(rng);
+        sim.vy[i] = speed(rng);
+        sim.vz[i] = speed(rng);
+        sim.radius[i] = instances[i].scale * meshRadius;
+    }
+}
+
+// Integrates one axis of [begin, end); written branch-free so the compiler vectorizes it
+static void integrateAxis(float* __restrict position, float* __restrict velocity, const float* __restrict radius,
+                          size_t begin, size_t end, float acceleration, float dt, float low, float high, float restitution) {
+    for (size_t i = begin; i < end; ++i) {
+        float v = velocity[i] + acceleration * dt;
+        float p = position[i] + v * dt;
+        float minP = low + radius[i];
+        float maxP = high - radius[i];
+
+        // Mirror the overshoot back inside the box and reverse the velocity
+        bool below = p < minP;
+        bool above = p > maxP;
+        p = below ? 2.0f * minP - p : above ? 2.0f * maxP - p : p;
+        v = below || above ? -v * restitution : v;
+
+        position[i] = p;
+        velocity[i] = v;
+    }
+}
+
+void stepParticleSim(ParticleSim& sim, float dt, ThreadPool& pool) {
+    pool.parallelForRange(sim.size(), simChunkSize, [&](size_t begin, size_t end) {
+        integrateAxis(sim.x.data(), sim.vx.data(), sim.radius.data(), begin, end, sim.gravity.x, dt, sim.boundsMin.x, sim.boundsMax.x, sim.restitution);
+        integrateAxis(sim.y.data(), sim.vy.data(), sim.radius.data(), begin, end, sim.gravity.y, dt, sim.boundsMin.y, sim.boundsMax.y, sim.restitution);
+        integrateAxis(sim.z.data(), sim.vz.data(), sim.radius.data(), begin, end, sim.gravity.z, dt, sim.boundsMin.z, sim.boundsMax.z, sim.restitution);
+    });
+}
+
+void writeParticleInstances(const ParticleSim& sim, const std::vector<InstanceData>& templates, std::span<InstanceData> out, ThreadPool& pool) {
+    // Whole records are written in order, which suits write-combined mapped memory
+    pool.parallelForRange(sim.size(), simChunkSize, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            InstanceData instance = templates[i];
+            instance.position = glm::vec3(sim.x[i], sim.y[i], sim.z[i]);
+            out[i] = instance;
+        }
+    });
+}
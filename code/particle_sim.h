@@ -0,0 +1,32 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <span>
+#include <vector>
+#include "instance_data.h"
+#include "thread_pool.h"
+
+// Ballistic spheres bouncing inside an axis-aligned box. State is kept as structure-of-arrays
+// so the integration loop streams through packed floats and vectorizes.
+struct ParticleSim {
+    std::vector<float> x, y, z;
+    std::vector<float> vx, vy, vz;
+    std::vector<float> radius;
+    glm::vec3 boundsMin = glm::vec3(0.0f);
+    glm::vec3 boundsMax = glm::vec3(0.0f);
+    glm::vec3 gravity = glm::vec3(0.0f, -9.81f, 0.0f);
+    float restitution = 1.0f;   // velocity kept on a bounce; 1 keeps the scene moving indefinitely
+
+    size_t size() const { return x.size(); }
+};
+
+// Starts every particle at its instance's position with a random velocity (fixed seed, so runs
+// are repeatable). meshRadius is the bounding radius of the unscaled mesh.
+void initParticleSim(ParticleSim& sim, const std::vector<InstanceData>& instances, float meshRadius,
+                     const glm::vec3& boundsMin, const glm::vec3& boundsMax, float maxSpeed);
+
+// Integrates velocity and position over dt (semi-implicit Euler) and reflects particles off the box.
+void stepParticleSim(ParticleSim& sim, float dt, ThreadPool& pool);
+
+// Writes each particle's instance record to out: the current position plus the scale,
+// rotation and color of templates. out may alias templates.
+void writeParticleInstances(const ParticleSim& sim, const std::vector<InstanceData>& templates, std::span<InstanceData> out, ThreadPool& pool);
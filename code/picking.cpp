@@ -0,0 +1,31 @@
+#include "picking.h"
+#include "cpu_culling.h"
+#include <cfloat>
+
+void createPicker(Picker& picker, const std::vector<InstanceData>& instances, float meshRadius, ThreadPool& pool) {
+    updateInstanceBounds(picker.bounds, instances, meshRadius, pool);
+    buildBvh(picker.bvh, picker.bounds, pool);
+}
+
+void updatePicker(Picker& picker, const std::vector<InstanceData>& instances, float meshRadius, ThreadPool& pool) {
+    updateInstanceBounds(picker.bounds, instances, meshRadius, pool);
+    refitBvh(picker.bvh, picker.bounds, pool);
+}
+
+void pixelRay(const glm::mat4& view, const glm::mat4& projection, float x, float y, int width, int height,
+              glm::vec3& origin, glm::vec3& direction) {
+    // Through the pixel's center, from the near to the far plane in normalized device coordinates
+    glm::vec2 ndc((x + 0.5f) / width * 2.0f - 1.0f, 1.0f - (y + 0.5f) / height * 2.0f);
+    glm::mat4 inverseViewProjection = glm::inverse(projection * view);
+    glm::vec4 nearPoint = inverseViewProjection * glm::vec4(ndc.x, ndc.y, -1.0f, 1.0f);
+    glm::vec4 farPoint = inverseViewProjection * glm::vec4(ndc.x, ndc.y, 1.0f, 1.0f);
+    origin = glm::vec3(nearPoint) / nearPoint.w;
+    direction = glm::normalize(glm::vec3(farPoint) / farPoint.w - origin);
+}
+
+bool pickInstance(const Picker& picker, const glm::mat4& view, const glm::mat4& projection, float x, float y,
+                  int width, int height, uint32_t& instance, float& distance) {
+    glm::vec3 origin, direction;
+    pixelRay(view, projection, x, y, width, height, origin, direction);
+    return raycastBvh(picker.bvh, origin, direction, FLT_MAX, instance, distance);
+}
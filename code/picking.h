@@ -0,0 +1,31 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+#include "bvh.h"
+#include "instance_data.h"
+#include "thread_pool.h"
+
+// Finds the instance under a pixel by casting a ray against a BVH over the instance bounding
+// spheres, so a pick visits a few dozen nodes instead of every instance. Works the same with
+// or without a window.
+struct Picker {
+    InstanceBounds bounds;
+    Bvh bvh;
+};
+
+// Builds the BVH over the instances; meshRadius is the bounding radius of the unscaled mesh.
+void createPicker(Picker& picker, const std::vector<InstanceData>& instances, float meshRadius, ThreadPool& pool);
+
+// Refits the BVH after the instances moved.
+void updatePicker(Picker& picker, const std::vector<InstanceData>& instances, float meshRadius, ThreadPool& pool);
+
+// World-space ray from the near plane through pixel (x, y) of a width x height viewport, with y
+// counting down from the top as window cursor positions do.
+void pixelRay(const glm::mat4& view, const glm::mat4& projection, float x, float y, int width, int height,
+              glm::vec3& origin, glm::vec3& direction);
+
+// Nearest instance whose bounding sphere the pixel's ray hits, and the distance from the near
+// plane. Returns false when the ray misses everything.
+bool pickInstance(const Picker& picker, const glm::mat4& view, const glm::mat4& projection, float x, float y,
+                  int width, int height, uint32_t& instance, float& distance);
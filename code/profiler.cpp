@@ -0,0 +1,153 @@
+#include "profiler.h"
+#include "frame_stats.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+static double profilerNowMs(const Profiler& profiler) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - profiler.origin).count();
+}
+
+static GLuint takeQuery(Profiler& profiler) {
+    GLuint query;
+    if (profiler.freeQueries.empty()) {
+        glGenQueries(1, &query);
+    } else {
+        query = profiler.freeQueries.back();
+        profiler.freeQueries.pop_back();
+    }
+    return query;
+}
+
+static void recordEvent(Profiler& profiler, const ProfileEvent& event) {
+    ProfileSeries* series = nullptr;
+    for (ProfileSeries& s : profiler.series) {
+        if (s.gpu == event.gpu && std::strcmp(s.name, event.name) == 0) series = &s;
+    }
+    if (!series) series = &profiler.series.emplace_back(ProfileSeries{event.name, event.gpu, {}});
+
+    if (series->durations.size() < profilerWindow) {
+        series->durations.push_back(event.durationMs);
+    } else {
+        series->durations[series->next] = event.durationMs;
+    }
+    series->next = (series->next + 1) % profilerWindow;
+
+    if (profiler.recordTrace) profiler.events.push_back(event);
+}
+
+// Reads back the GPU scopes issued up to lastFrame; GL_QUERY_RESULT waits if they are not done
+static void collectGpuScopes(Profiler& profiler, int lastFrame) {
+    auto done = std::stable_partition(profiler.pendingGpuScopes.begin(), profiler.pendingGpuScopes.end(),
+                                      [&](const PendingGpuScope& scope) { return scope.frame > lastFrame; });
+    for (auto it = done; it != profiler.pendingGpuScopes.end(); ++it) {
+        GLuint64 begin = 0, end = 0;
+        glGetQueryObjectui64v(it->begin, GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(it->end, GL_QUERY_RESULT, &end);
+        recordEvent(profiler, {it->name, true, it->frame, (GLint64)(begin - profiler.gpuOrigin) / 1e6, (end - begin) / 1e6});
+        profiler.freeQueries.push_back(it->begin);
+        profiler.freeQueries.push_back(it->end);
+    }
+    profiler.pendingGpuScopes.erase(done, profiler.pendingGpuScopes.end());
+}
+
+void createProfiler(Profiler& profiler, bool recordTrace) {
+    profiler = {};
+    profiler.enabled = true;
+    profiler.recordTrace = recordTrace;
+    // The GPU clock has its own epoch; pairing it with the CPU clock once puts both on one timeline
+    glGetInteger64v(GL_TIMESTAMP, &profiler.gpuOrigin);
+    profiler.origin = std::chrono::steady_clock::now();
+}
+
+void beginProfilerFrame(Profiler& profiler) {
+    if (!profiler.enabled) return;
+    ++profiler.frame;
+    collectGpuScopes(profiler, profiler.frame - profilerGpuLatency);
+}
+
+void beginProfileScope(Profiler& profiler, const char* name, bool gpu) {
+    if (!profiler.enabled) return;
+    GLuint gpuBegin = 0;
+    if (gpu) {
+        gpuBegin = takeQuery(profiler);
+        glQueryCounter(gpuBegin, GL_TIMESTAMP);
+    }
+    profiler.openScopes.push_back({name, profilerNowMs(profiler), gpuBegin});
+}
+
+void endProfileScope(Profiler& profiler) {
+    if (!profiler.enabled || profiler.openScopes.empty()) return;
+    OpenProfileScope scope = profiler.openScopes.back();
+    profiler.openScopes.pop_back();
+
+    if (scope.gpuBegin) {
+        GLuint gpuEnd = takeQuery(profiler);
+        glQueryCounter(gpuEnd, GL_TIMESTAMP);
+        profiler.pendingGpuScopes.push_back({scope.name, profiler.frame, scope.gpuBegin, gpuEnd});
+    }
+    recordEvent(profiler, {scope.name, false, profiler.frame, scope.startMs, profilerNowMs(profiler) - scope.startMs});
+}
+
+void flushProfiler(Profiler& profiler) {
+    if (!profiler.enabled) return;
+    collectGpuScopes(profiler, profiler.frame);
+}
+
+void printProfileSummary(const Profiler& profiler) {
+    if (!profiler.enabled) return;
+    std::printf("scope (ms, last %zu)  cpu p50   p95     p99     gpu p50   p95     p99\n", profilerWindow);
+
+    // One row per name, in the order the scopes first ran
+    std::vector<const char*> names;
+    for (const ProfileSeries& series : profiler.series) {
+        bool seen = false;
+        for (const char* name : names) seen |= std::strcmp(name, series.name) == 0;
+        if (!seen) names.push_back(series.name);
+    }
+    for (const char* name : names) {
+        std::printf("%-20s", name);
+        for (bool gpu : {false, true}) {
+            const ProfileSeries* match = nullptr;
+            for (const ProfileSeries& series : profiler.series) {
+                if (series.gpu == gpu && std::strcmp(series.name, name) == 0) match = &series;
+            }
+            if (!match) {
+                std::printf("    %-7s %-7s %-7s", "-", "-", "-");
+                continue;
+            }
+            std::vector<double> sorted = match->durations;
+            std::sort(sorted.begin(), sorted.end());
+            std::printf("    %-7.3f %-7.3f %-7.3f", percentile(sorted, 0.50), percentile(sorted, 0.95), percentile(sorted, 0.99));
+        }
+        std::printf("\n");
+    }
+}
+
+bool writeChromeTrace(const Profiler& profiler, const std::string& path) {
+    FILE* file = std::fopen(path.c_str(), "w");
+    if (!file) return false;
+
+    // Complete ("X") events in microseconds; tid 1 is the CPU track, tid 2 the GPU track
+    std::fprintf(file, "{\"traceEvents\":[\n");
+    std::fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n");
+    std::fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}");
+    for (const ProfileEvent& event : profiler.events) {
+        std::fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%d}}",
+                     event.name, event.gpu ? "gpu" : "cpu", event.gpu ? 2 : 1, event.startMs * 1000.0, event.durationMs * 1000.0, event.frame);
+    }
+    std::fprintf(file, "\n]}\n");
+    return std::fclose(file) == 0;
+}
+
+void destroyProfiler(Profiler& profiler) {
+    for (const OpenProfileScope& scope : profiler.openScopes) {
+        if (scope.gpuBegin) glDeleteQueries(1, &scope.gpuBegin);
+    }
+    for (const PendingGpuScope& scope : profiler.pendingGpuScopes) {
+        glDeleteQueries(1, &scope.begin);
+        glDeleteQueries(1, &scope.end);
+    }
+    if (!profiler.freeQueries.empty()) glDeleteQueries((GLsizei)profiler.freeQueries.size(), profiler.freeQueries.data());
+    profiler = {};
+}
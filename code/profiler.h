@@ -0,0 +1,82 @@
+#pragma once
+#include <GL/glew.h>
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// GPU timestamps are read back this many frames after they were issued; by then the GPU has
+// normally passed them, so reading them does not stall the pipeline.
+constexpr int profilerGpuLatency = 3;
+
+// Durations kept per scope for the rolling percentiles
+constexpr size_t profilerWindow = 240;
+
+// A finished scope in ms since the profiler was created. GPU scopes are moved onto the CPU clock.
+struct ProfileEvent {
+    const char* name;
+    bool gpu;
+    int frame;
+    double startMs;
+    double durationMs;
+};
+
+// Last profilerWindow durations of one scope, as a ring
+struct ProfileSeries {
+    const char* name;
+    bool gpu;
+    std::vector<double> durations;
+    size_t next = 0;
+};
+
+struct OpenProfileScope {
+    const char* name;
+    double startMs;
+    GLuint gpuBegin;    // 0 for CPU-only scopes
+};
+
+struct PendingGpuScope {
+    const char* name;
+    int frame;
+    GLuint begin;
+    GLuint end;
+};
+
+// Frame profiler with named CPU scopes and GL_TIMESTAMP query pairs around the GL commands in
+// GPU scopes. Queries come from a pool and are read back profilerGpuLatency frames later.
+// Scope names must outlive the profiler (string literals). Every call does nothing until
+// createProfiler, so call sites need no checks of their own.
+struct Profiler {
+    bool enabled = false;
+    bool recordTrace = false;       // keep every event for writeChromeTrace
+    std::chrono::steady_clock::time_point origin;
+    GLint64 gpuOrigin = 0;          // GL_TIMESTAMP at origin, ns
+    int frame = -1;
+    std::vector<OpenProfileScope> openScopes;
+    std::vector<PendingGpuScope> pendingGpuScopes;
+    std::vector<GLuint> freeQueries;
+    std::vector<ProfileSeries> series;
+    std::vector<ProfileEvent> events;
+};
+
+void createProfiler(Profiler& profiler, bool recordTrace);
+
+// Starts the next frame and collects the GPU scopes old enough to have finished.
+void beginProfilerFrame(Profiler& profiler);
+
+// Opens a scope timed on the CPU and, with gpu, by timestamps around the GL commands issued
+// until the matching endProfileScope. Scopes nest.
+void beginProfileScope(Profiler& profiler, const char* name, bool gpu = true);
+void endProfileScope(Profiler& profiler);
+
+// Waits for and collects every outstanding GPU scope, e.g. before reporting.
+void flushProfiler(Profiler& profiler);
+
+// Prints p50/p95/p99 of every scope's CPU and GPU time over its last profilerWindow runs.
+void printProfileSummary(const Profiler& profiler);
+
+// Writes the recorded events as Chrome trace JSON (chrome://tracing, Perfetto), CPU and GPU
+// scopes on separate tracks.
+bool writeChromeTrace(const Profiler& profiler, const std::string& path);
+
+void destroyProfiler(Profiler& profiler);
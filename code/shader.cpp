@@ -0,0 +1,213 @@
+#include "shader.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// Issues the compile without reading its status, which would wait for it
+static GLuint startShader(GLenum type, const char* source, const std::string& defines) {
+    std::string text = source;
+    text.insert(text.find('\n', text.find("#version")) + 1, defines);
+    const char* textPtr = text.c_str();
+
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &textPtr, nullptr);
+    glCompileShader(shader);
+    return shader;
+}
+
+static bool checkShader(GLuint shader) {
+    int success;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+    if (!success) {
+        char infoLog[512];
+        glGetShaderInfoLog(shader, 512, nullptr, infoLog);
+        std::cerr << "Error compiling shader: " << infoLog << std::endl;
+    }
+    return success;
+}
+
+static bool checkProgram(GLuint program) {
+    int success;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        char infoLog[512];
+        glGetProgramInfoLog(program, 512, nullptr, infoLog);
+        std::cerr << "Error linking program: " << infoLog << std::endl;
+    }
+    return success;
+}
+
+constexpr uint32_t programCacheMagic = 0x4e494250; // "PBIN"
+
+// 64-bit FNV-1a
+static uint64_t hashText(const std::string& text) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (unsigned char c : text) hash = (hash ^ c) * 0x100000001b3ull;
+    return hash;
+}
+
+static std::string glString(GLenum name) {
+    const GLubyte* text = glGetString(name);
+    return text ? (const char*)text : "";
+}
+
+void createProgramCache(ProgramCache& cache, const std::string& directory) {
+    cache = {};
+    if (GLEW_KHR_parallel_shader_compile) {
+        // Compiler threads beside the main thread, which keeps one core for the rest of startup;
+        // on a single core, 0 makes the driver compile on the calling thread as without the extension
+        GLuint threads = std::max(1u, std::thread::hardware_concurrency()) - 1;
+        glMaxShaderCompilerThreadsKHR(threads);
+        cache.parallel = threads > 0;
+    }
+    if (directory.empty()) return;
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    if (formats == 0) {
+        std::cerr << "The driver offers no program binary formats; shaders are compiled every run" << std::endl;
+        return;
+    }
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    if (error) {
+        std::cerr << "Cannot create shader cache " << directory << ": " << error.message() << std::endl;
+        return;
+    }
+    cache.directory = directory;
+    cache.driver = glString(GL_VENDOR) + "\n" + glString(GL_RENDERER) + "\n" + glString(GL_VERSION) + "\n";
+}
+
+// File layout: magic, key size, key, binary format, binary size, binary
+static GLuint loadProgram(const std::string& path, const std::string& key) {
+    std::ifstream file(path, std::ios::binary);
+    uint32_t header[2] = {};
+    if (!file.read((char*)header, sizeof(header)) || header[0] != programCacheMagic || header[1] != key.size()) return 0;
+    std::string storedKey(key.size(), '\0');
+    if (!file.read(storedKey.data(), storedKey.size()) || storedKey != key) return 0;
+    uint32_t binaryHeader[2] = {};
+    if (!file.read((char*)binaryHeader, sizeof(binaryHeader))) return 0;
+    std::vector<char> binary(binaryHeader[1]);
+    if (!file.read(binary.data(), binary.size())) return 0;
+
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, binaryHeader[0], binary.data(), (GLsizei)binary.size());
+    int success;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        // Typically a driver update that changed the binary format; the caller recompiles
+        glDeleteProgram(program);
+        while (glGetError() != GL_NO_ERROR) {}
+        return 0;
+    }
+    return program;
+}
+
+static void storeProgram(const std::string& path, const std::string& key, GLuint program) {
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) return;
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, &length, &format, binary.data());
+
+    // Written next to the entry and renamed over it, so a concurrent run never reads half a file
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary);
+        uint32_t header[2] = {programCacheMagic, (uint32_t)key.size()};
+        uint32_t binaryHeader[2] = {format, (uint32_t)length};
+        file.write((const char*)header, sizeof(header));
+        file.write(key.data(), key.size());
+        file.write((const char*)binaryHeader, sizeof(binaryHeader));
+        file.write(binary.data(), length);
+        if (!file) return;
+    }
+    std::error_code error;
+    std::filesystem::rename(temporary, path, error);
+    if (error) std::cerr << "Cannot write shader cache entry " << path << ": " << error.message() << std::endl;
+}
+
+static double millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+GLuint submitProgram(ProgramCache& cache, std::initializer_list<ShaderStage> stages) {
+    auto start = std::chrono::steady_clock::now();
+    ++cache.programs;
+
+    PendingProgram pending;
+    if (!cache.directory.empty()) {
+        pending.key = cache.driver;
+        for (const ShaderStage& stage : stages) pending.key += std::to_string(stage.type) + "\n" + stage.defines + "\n" + stage.source;
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)hashText(pending.key));
+        pending.path = (std::filesystem::path(cache.directory) / name).string();
+        // Loading a binary is quick, so it is checked right away
+        if (GLuint program = loadProgram(pending.path, pending.key)) {
+            ++cache.loaded;
+            cache.buildMs += millisecondsSince(start);
+            return program;
+        }
+    }
+
+    pending.program = glCreateProgram();
+    // Without the hint a driver may drop what it needs for glGetProgramBinary after linking
+    if (!pending.path.empty()) glProgramParameteri(pending.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    for (const ShaderStage& stage : stages) {
+        pending.shaders.push_back(startShader(stage.type, stage.source, stage.defines));
+        glAttachShader(pending.program, pending.shaders.back());
+    }
+    glLinkProgram(pending.program);
+    GLuint program = pending.program;
+    cache.pending.push_back(std::move(pending));
+    cache.buildMs += millisecondsSince(start);
+    return program;
+}
+
+static void finishProgram(ProgramCache& cache, const PendingProgram& pending) {
+    int linked;
+    glGetProgramiv(pending.program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        for (GLuint shader : pending.shaders) checkShader(shader);
+        checkProgram(pending.program);
+        ++cache.failed;
+    } else if (!pending.path.empty()) {
+        storeProgram(pending.path, pending.key, pending.program);
+    }
+    for (GLuint shader : pending.shaders) {
+        glDetachShader(pending.program, shader);
+        glDeleteShader(shader);
+    }
+}
+
+// Finishes the programs the driver is done with, or all of them with wait
+static void finishPrograms(ProgramCache& cache, bool wait) {
+    auto start = std::chrono::steady_clock::now();
+    std::erase_if(cache.pending, [&](const PendingProgram& pending) {
+        if (!wait) {
+            // Without the extension there is nothing to poll; any query would wait for the link
+            if (!cache.parallel) return false;
+            GLint complete = GL_FALSE;
+            glGetProgramiv(pending.program, GL_COMPLETION_STATUS_KHR, &complete);
+            if (!complete) return false;
+        }
+        finishProgram(cache, pending);
+        return true;
+    });
+    cache.buildMs += millisecondsSince(start);
+}
+
+void pollPrograms(ProgramCache& cache) {
+    finishPrograms(cache, false);
+}
+
+bool finishPrograms(ProgramCache& cache) {
+    finishPrograms(cache, true);
+    return cache.failed == 0;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <GL/glew.h>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+// One stage of a program; `defines` is inserted right after the #version line of `source`
+struct ShaderStage {
+    GLenum type;
+    const char* source;
+    std::string defines;
+};
+
+// A program whose compile and link may still be running in the driver
+struct PendingProgram {
+    GLuint program = 0;
+    std::vector<GLuint> shaders;    // kept attached until the link is checked, for their logs
+    std::string path;               // cache entry to write once linked, empty without a cache
+    std::string key;
+};
+
+// Builds every GL program: submitProgram only issues the compile and link, which the driver
+// runs on its own threads where it has KHR_parallel_shader_compile, so startup work can go on
+// until finishPrograms. Optionally backed by an on-disk cache of linked programs as
+// glGetProgramBinary blobs, one file per program named by a hash of its stage sources and the
+// GL vendor, renderer and version. Each file repeats the full key, so a hash collision or a
+// driver change falls back to compiling and replaces the entry.
+struct ProgramCache {
+    std::string directory;  // empty = always compile
+    std::string driver;     // vendor, renderer and version, part of every key
+    bool parallel = false;  // KHR_parallel_shader_compile is available
+    int programs = 0;       // submitted
+    int loaded = 0;         // of those, loaded from the cache
+    int failed = 0;         // of those, failed to link
+    double buildMs = 0.0;   // main thread time spent submitting, polling and waiting
+    std::vector<PendingProgram> pending;
+};
+
+// Enables parallel compilation where supported and caches programs in directory, creating it
+// if needed; an empty directory, or a driver without program binary formats, disables the cache.
+void createProgramCache(ProgramCache& cache, const std::string& directory);
+
+// Returns the program right away, loaded from the cache or with its compile and link issued.
+// Using it before finishPrograms makes the driver wait for it.
+GLuint submitProgram(ProgramCache& cache, std::initializer_list<ShaderStage> stages);
+
+// Checks the programs that have finished linking and stores them in the cache, without waiting.
+// Does nothing without KHR_parallel_shader_compile.
+void pollPrograms(ProgramCache& cache);
+
+// Waits for every submitted program; false if any failed to link.
+bool finishPrograms(ProgramCache& cache);
@@ -0,0 +1,85 @@
+#include "sweep.h"
+#include "mesh.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <string>
+#include <unistd.h>
+
+constexpr size_t sweepCounts[] = {1000, 10000, 100000, 1000000, 10000000};
+
+// A larger count is skipped once its projected mean frame time, scaled from the last run of the
+// same tessellation, goes past this
+constexpr double sweepFrameBudgetMs = 5000.0;
+
+size_t residentBytes() {
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0, residentPages = 0;
+    if (!(statm >> pages >> residentPages)) return 0;
+    return residentPages * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+bool runSweep(const Options& options, const std::function<int(const Options&, SceneRun*)>& runScene) {
+    FILE* csv = std::fopen(options.sweepPath.c_str(), "w");
+    if (!csv) {
+        std::cerr << "Cannot write " << options.sweepPath << std::endl;
+        return false;
+    }
+    std::fprintf(csv, "instances,grid,mesh,detail,triangles_per_instance,frames,mean_ms,p50_ms,p99_ms,"
+                      "vertices_per_sec,triangles_per_sec,instance_buffer_mb,rss_mb,status\n");
+
+    // Same tessellations as the LOD chain, each roughly quadrupling the triangles
+    std::vector<int> details = options.sphereMesh == SphereMesh::Icosphere ? std::vector<int>{0, 1, 2, 3} : std::vector<int>{4, 8, 16, 32};
+    if (options.impostors || options.lod || options.sphereDetail >= 0) details = {options.sphereDetail};
+    const char* mesh = options.impostors ? "impostor" : options.lod ? "lod" : sphereMeshName(options.sphereMesh);
+
+    for (int detail : details) {
+        double projectedMs = 0.0;
+        size_t lastCount = 0;
+        for (size_t count : sweepCounts) {
+            int side = std::max(1, (int)std::lround(std::cbrt((double)count)));
+            size_t instances = (size_t)side * side * side;
+            std::string detailText = detail >= 0 ? std::to_string(detail) : "-";
+
+            if (lastCount && projectedMs * instances / lastCount > sweepFrameBudgetMs) {
+                std::fprintf(csv, "%zu,%dx%dx%d,%s,%s,,,,,,,,,,skipped\n", instances, side, side, side, mesh, detailText.c_str());
+                std::fflush(csv);
+                continue;
+            }
+
+            Options runOptions = options;
+            runOptions.headless = true;
+            runOptions.gridX = runOptions.gridY = runOptions.gridZ = side;
+            if (!options.impostors && !options.lod) runOptions.sphereDetail = detail;
+            if (runOptions.maxSeconds == 0.0f) runOptions.maxSeconds = 2.0f;
+
+            std::cout << "\nSweep: " << instances << " instances, " << mesh << " " << detailText << std::endl;
+            SceneRun run;
+            if (runScene(runOptions, &run) != 0 || run.stats.frameMs.empty()) {
+                std::fprintf(csv, "%zu,%dx%dx%d,%s,%s,,,,,,,,,,failed\n", instances, side, side, side, mesh, detailText.c_str());
+                std::fflush(csv);
+                // Larger counts would fail the same way
+                break;
+            }
+
+            const std::vector<double>& frameMs = run.stats.frameMs;
+            std::vector<double> sorted = frameMs;
+            std::sort(sorted.begin(), sorted.end());
+            double totalMs = std::accumulate(frameMs.begin(), frameMs.end(), 0.0);
+            double vertices = std::accumulate(run.visibleVertices.begin(), run.visibleVertices.end(), 0.0);
+            double triangles = std::accumulate(run.stats.visibleTriangles.begin(), run.stats.visibleTriangles.end(), 0.0);
+            double meanMs = totalMs / frameMs.size();
+            std::fprintf(csv, "%zu,%dx%dx%d,%s,%s,%zu,%zu,%.3f,%.3f,%.3f,%.0f,%.0f,%.2f,%.2f,ok\n",
+                         run.instances, side, side, side, mesh, detailText.c_str(), run.trianglesPerInstance, frameMs.size(),
+                         meanMs, percentile(sorted, 0.50), percentile(sorted, 0.99), vertices * 1000.0 / totalMs,
+                         triangles * 1000.0 / totalMs, run.instanceBufferBytes / 1048576.0, run.residentBytes / 1048576.0);
+            std::fflush(csv);
+            projectedMs = meanMs;
+            lastCount = run.instances;
+        }
+    }
+    return std::fclose(csv) == 0;
+}
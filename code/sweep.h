@@ -0,0 +1,25 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <vector>
+#include "frame_stats.h"
+#include "options.h"
+
+// What a headless scene run measured, for one row of the sweep
+struct SceneRun {
+    FrameStats stats;
+    std::vector<double> visibleVertices;    // per timed frame, vertices of the drawn instances
+    size_t instances = 0;
+    size_t trianglesPerInstance = 0;        // finest LOD
+    size_t instanceBufferBytes = 0;         // per-instance GPU buffers, all stream segments included
+    size_t residentBytes = 0;               // process RSS after the timed frames
+};
+
+// Resident set size of this process, 0 where /proc is not available
+size_t residentBytes();
+
+// Renders the scene headless over cubic grids of 1K to 10M instances for each tessellation of
+// options.sphereMesh (only the given one with --sphere-detail, --impostors or --lod) and writes
+// one CSV row per run to csvPath. Runs that would take too long are skipped and marked as such.
+// options.maxSeconds defaults to 2 s per run here.
+bool runSweep(const Options& options, const std::function<int(const Options&, SceneRun*)>& runScene);
@@ -0,0 +1,76 @@
+#include "thread_pool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned threadCount) {
+    if (threadCount == 0) threadCount = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned i = 1; i < threadCount; ++i) {
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers) worker.join();
+}
+
+void ThreadPool::runTasks() {
+    for (size_t i = nextTask.fetch_add(1); i < taskCount; i = nextTask.fetch_add(1)) {
+        (*task)(i);
+    }
+}
+
+void ThreadPool::workerLoop() {
+    size_t seenGeneration = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || generation != seenGeneration; });
+            if (stopping) return;
+            seenGeneration = generation;
+        }
+
+        runTasks();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--activeWorkers == 0) done.notify_one();
+    }
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)>& fn) {
+    if (count == 0) return;
+    if (workers.empty() || count == 1) {
+        for (size_t i = 0; i < count; ++i) fn(i);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        task = &fn;
+        taskCount = count;
+        nextTask = 0;
+        activeWorkers = (unsigned)workers.size();
+        ++generation;
+    }
+    wake.notify_all();
+
+    runTasks();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&] { return activeWorkers == 0; });
+    task = nullptr;
+}
+
+void ThreadPool::parallelForRange(size_t count, size_t minRange, const std::function<void(size_t, size_t)>& fn) {
+    // A few ranges per thread keeps the load balanced without much scheduling overhead
+    size_t rangeCount = std::max<size_t>(1, std::min<size_t>(size() * 4, count / std::max<size_t>(minRange, 1)));
+    size_t rangeSize = (count + rangeCount - 1) / rangeCount;
+    parallelFor(rangeCount, [&](size_t range) {
+        size_t begin = range * rangeSize;
+        size_t end = std::min(count, begin + rangeSize);
+        if (begin < end) fn(begin, end);
+    });
+}
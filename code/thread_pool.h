@@ -0,0 +1,44 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for data-parallel loops. The calling thread takes part in
+// every loop, so a pool of size 1 runs everything inline.
+class ThreadPool {
+public:
+    // threadCount includes the calling thread; 0 uses every hardware thread.
+    explicit ThreadPool(unsigned threadCount = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned size() const { return (unsigned)workers.size() + 1; }
+
+    // Runs task(i) for every i in [0, count), handing indices out dynamically. Blocks until done.
+    void parallelFor(size_t count, const std::function<void(size_t)>& task);
+
+    // Splits [0, count) into ranges of at least minRange items and runs task(begin, end) on each.
+    void parallelForRange(size_t count, size_t minRange, const std::function<void(size_t, size_t)>& task);
+
+private:
+    void workerLoop();
+    void runTasks();
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    const std::function<void(size_t)>* task = nullptr;
+    size_t taskCount = 0;
+    std::atomic<size_t> nextTask = 0;
+    size_t generation = 0;
+    unsigned activeWorkers = 0;
+    bool stopping = false;
+};